@@ -0,0 +1,108 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: SPI.c
+ */
+
+#ifdef SPI_INPUT_ENABLE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "lcdLib.h"
+#include "SPI.h"
+
+#ifdef HC595_MODE
+#error "SPI_INPUT_ENABLE and HC595_MODE are mutually exclusive (the SPI drives the LCD)"
+#endif
+
+#ifdef LCD_DEFAULT_MODE
+#error "SPI_INPUT_ENABLE can't be used with LCD_DEFAULT_MODE (its data bus is all of PORTB)"
+#elif !defined (PCF8574_MODE) && !defined (LCD_PINS_CLEAR_OF_SPI)
+#error "SPI_INPUT_ENABLE needs PB2-PB5; move the LCD pins off them (see lcdLibConfig.h)"
+#endif
+
+#ifndef SPI_RECEIVE_DATA              /* overridden by host (off-target) builds */
+#define SPI_RECEIVE_DATA()      SPDR
+#define SPI_TRANSMIT_DATA(data) (SPDR = (data))
+#endif
+
+#define SPI_RX_BUFFER_MASK (SPI_RX_BUFFER_SIZE - 1)
+
+static volatile uint8_t rxBuffer[SPI_RX_BUFFER_SIZE];
+static volatile uint8_t rxHead;           /* next free slot (written by ISR) */
+static volatile uint8_t rxTail;           /* next byte to read (written by caller) */
+static volatile uint16_t rxOverruns;      /* bytes lost (receive buffer full) */
+
+void initSPISlave(void) {
+  DDRB |= (1 << PB4);                     /* MISO; SS, MOSI and SCK are inputs */
+  SPCR = (1 << SPE) | (1 << SPIE);        /* Slave, mode 0, MSB first */
+  SPI_TRANSMIT_DATA(0);                   /* First status: nothing waiting */
+
+  set_sleep_mode(SLEEP_MODE_IDLE);        /* spiReceiveByte sleeps; the SPI keeps running */
+}
+
+ISR(SPI_STC_vect) {
+  uint8_t data = SPI_RECEIVE_DATA();
+  uint8_t next = (rxHead + 1) & SPI_RX_BUFFER_MASK;
+
+  if (next == rxTail) {
+    rxOverruns++;                         /* Buffer full; drop the byte */
+  } else {
+    rxBuffer[rxHead] = data;
+    rxHead = next;
+  }
+
+  SPI_TRANSMIT_DATA((rxHead - rxTail) & SPI_RX_BUFFER_MASK);  /* Status for the next byte */
+}
+
+uint8_t spiByteAvailable(void) {
+  return rxHead != rxTail;
+}
+
+uint8_t spiReceiveBacklog(void) {
+  return (rxHead - rxTail) & SPI_RX_BUFFER_MASK;
+}
+
+uint8_t spiReceiveByte(void) {
+  cli();
+  while (rxHead == rxTail) {              /* Sleep until data arrives */
+    sleep_enable();
+    sei();                                /* Takes effect after sleep_cpu */
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+
+  uint8_t data = rxBuffer[rxTail];
+  rxTail = (rxTail + 1) & SPI_RX_BUFFER_MASK;
+  /* Refresh the status for a master waiting for room (ignored if a transfer is under way) */
+  SPI_TRANSMIT_DATA((rxHead - rxTail) & SPI_RX_BUFFER_MASK);
+  sei();
+
+  return data;
+}
+
+uint16_t spiReceiveOverruns(void) {
+  cli();
+  uint16_t n = rxOverruns;
+  sei();
+  return n;
+}
+
+#endif
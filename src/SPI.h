@@ -0,0 +1,70 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file SPI.h
+ * @brief SPI slave reception, an alternative input to the USART for faster hosts.
+ *
+ * Built only when SPI_INPUT_ENABLE is defined (eg. CPPFLAGS += -DSPI_INPUT_ENABLE), which also
+ * makes uart_echo take its input from the SPI instead of the USART.
+ *
+ * The host is the SPI master (mode 0, MSB first) on the ATmega328P's SS (PB2), MOSI (PB3),
+ * MISO (PB4) and SCK (PB5) pins, so the LCD must not use them (see lcdLibConfig.h). Each byte
+ * must be taken by the transfer complete interrupt (about 60 cycles) before the next one
+ * completes, so the master must leave at least SPI_BYTE_US between the starts of consecutive
+ * bytes; the clock itself may run at up to F_CPU/4.
+ *
+ * While each byte is shifted in, a status byte is shifted out on MISO: the number of bytes
+ * waiting in the receive buffer, as of the previous byte or the last byte taken from the buffer
+ * since. A byte sent with the buffer full is lost, so once the status exceeds half the buffer
+ * the master should pause before sending its next byte (which reports the fill afresh),
+ * doubling the pause while it stays high: rendering stalls for milliseconds at times.
+ */
+
+#ifndef SPI_RX_BUFFER_SIZE
+#define SPI_RX_BUFFER_SIZE 64   ///< Receive buffer size (holds one less); must be a power of two
+#endif
+#ifndef SPI_BYTE_US
+#define SPI_BYTE_US 10          ///< Shortest time between the bytes sent by the master
+#endif
+
+/**
+   Initialize the SPI in slave mode. Reception is interrupt driven (into a buffer of
+   SPI_RX_BUFFER_SIZE bytes) and sets the sleep mode to idle; global interrupts must be enabled
+   to receive.
+*/
+void initSPISlave(void);
+
+/**
+   Returns non-zero if a received byte is waiting to be read.
+*/
+uint8_t spiByteAvailable(void);
+
+/**
+   Returns the number of received bytes waiting to be read.
+*/
+uint8_t spiReceiveBacklog(void);
+
+/**
+   Receive a single byte, sleeping (idle mode) until one is available.
+*/
+uint8_t spiReceiveByte(void);
+
+/**
+   Returns the number of received bytes lost so far because the receive buffer was full.
+*/
+uint16_t spiReceiveOverruns(void);
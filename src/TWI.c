@@ -0,0 +1,224 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: TWI.c
+ */
+
+#ifdef TWI_INPUT_ENABLE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "lcdLib.h"
+#include "TWI.h"
+
+#ifndef LCD_SHADOW_ENABLE
+#error "TWI_INPUT_ENABLE requires LCD_SHADOW_ENABLE (cells are read from the SRAM shadow)"
+#endif
+#ifdef PCF8574_MODE
+#error "TWI_INPUT_ENABLE and PCF8574_MODE are mutually exclusive (the TWI drives the LCD)"
+#endif
+
+#define TWI_BUFFER_MASK (TWI_BUFFER_SIZE - 1)
+
+#define TWI_CONTROL ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+/* Slave status codes (TWSR with the prescaler bits masked) */
+#define TWI_SR_SLA_ACK       0x60  /* own SLA+W received, ACK returned */
+#define TWI_SR_DATA_ACK      0x80  /* data received, ACK returned */
+#define TWI_SR_DATA_NACK     0x88  /* data received, NACK returned */
+#define TWI_SR_STOP          0xa0  /* STOP or repeated START while addressed */
+#define TWI_ST_SLA_ACK       0xa8  /* own SLA+R received, ACK returned */
+#define TWI_ST_DATA_ACK      0xb8  /* data transmitted, ACK received */
+#define TWI_ST_DATA_NACK     0xc0  /* data transmitted, NACK received */
+#define TWI_ST_LAST_DATA     0xc8  /* last data transmitted, ACK received */
+
+/* Kinds of buffered record */
+#define RECORD_STREAM  0           /* a byte for the terminal */
+#define RECORD_ADDRESS 1           /* the cell address for the cells that follow */
+#define RECORD_CELL    2           /* a character for the cell at the cell address */
+
+static volatile uint8_t buffer[TWI_BUFFER_SIZE];
+static volatile uint8_t kinds[TWI_BUFFER_SIZE];
+static volatile uint8_t head;             /* next free slot (written by ISR) */
+static volatile uint8_t tail;             /* next record to apply (written by caller) */
+static volatile uint16_t refused;         /* data bytes not acknowledged */
+
+/* Interrupt state */
+static uint8_t reg;                       /* register being accessed */
+static uint8_t regPending;                /* the next byte written is the register number */
+static uint8_t regBytes;                  /* data bytes written to reg in this transaction */
+static uint8_t cursorRow;
+static uint8_t isrAddr;                   /* cell address, as of the records queued */
+static uint8_t readIndex;                 /* bytes read from reg since it was written */
+
+/* Cell address as of the records applied */
+static uint8_t cellAddr;
+
+static uint8_t nextCell(uint8_t addr) {
+  return addr + 1 < LCD_CHARACTERS_PER_SCREEN ? addr + 1 : 0;
+}
+
+static void queue(uint8_t kind, uint8_t data) {
+  buffer[head] = data;
+  kinds[head] = kind;
+  head = (head + 1) & TWI_BUFFER_MASK;
+}
+
+static uint8_t readRegister(void) {
+  uint8_t data;
+
+  switch (reg) {
+  case TWI_REG_CURSOR:
+    if (readIndex++ & 1)
+      return isrAddr % LCD_CHARACTERS_PER_LINE;
+    return isrAddr / LCD_CHARACTERS_PER_LINE;
+  case TWI_REG_CELLS:
+    data = readCharFromLCD(isrAddr / LCD_CHARACTERS_PER_LINE + 1, isrAddr % LCD_CHARACTERS_PER_LINE + 1);
+    isrAddr = nextCell(isrAddr);
+    return data;
+  default:
+    return (head - tail) & TWI_BUFFER_MASK;
+  }
+}
+
+void initTWISlave(void) {
+  TWAR = TWI_ADDRESS << 1;                /* No general call */
+  TWCR = (1 << TWEN) | (1 << TWIE) | (1 << TWEA);
+
+  set_sleep_mode(SLEEP_MODE_IDLE);        /* twiReceiveByte sleeps; the TWI keeps running */
+}
+
+ISR(TWI_vect) {
+  uint8_t ack = 1;
+  uint8_t data;
+
+  switch (TWSR & 0xf8) {
+  case TWI_SR_SLA_ACK:
+    regPending = 1;
+    break;
+  case TWI_SR_DATA_ACK:
+    data = TWDR;
+    if (regPending) {
+      reg = data;
+      regPending = 0;
+      regBytes = 0;
+      readIndex = 0;
+    } else if (reg == TWI_REG_CURSOR) {
+      if (regBytes++ == 0) {
+        cursorRow = data;
+      } else if (regBytes == 2 && cursorRow < LCD_NUMBER_OF_LINES && data < LCD_CHARACTERS_PER_LINE) {
+        isrAddr = cursorRow * LCD_CHARACTERS_PER_LINE + data;
+      }
+    } else if (reg == TWI_REG_CELLS) {
+      if (regBytes++ == 0)
+        queue(RECORD_ADDRESS, isrAddr);   /* The cell address may have moved since */
+      queue(RECORD_CELL, data);
+      isrAddr = nextCell(isrAddr);
+    } else {
+      queue(RECORD_STREAM, data);
+    }
+    /* Refuse the next byte unless there is room for it; cursor bytes are not buffered */
+    ack = reg == TWI_REG_CURSOR || ((tail - head - 1) & TWI_BUFFER_MASK) >= 2;
+    break;
+  case TWI_SR_DATA_NACK:
+    refused++;                            /* Dropped; the master sends it again */
+    break;
+  case TWI_ST_SLA_ACK:
+  case TWI_ST_DATA_ACK:
+    TWDR = readRegister();
+    break;
+  case TWI_SR_STOP:
+  case TWI_ST_DATA_NACK:
+  case TWI_ST_LAST_DATA:
+    break;
+  default:                                /* Bus error; release the bus */
+    TWCR = TWI_CONTROL | (1 << TWSTO) | (1 << TWEA);
+    return;
+  }
+
+  TWCR = TWI_CONTROL | (ack ? (1 << TWEA) : 0);
+}
+
+/*
+  Apply the cell writes at the head of the buffer, a run of cells on one row at a time.
+ */
+static void applyCells(void) {
+  char run[LCD_CHARACTERS_PER_LINE];
+
+  while (head != tail && kinds[tail] != RECORD_STREAM) {
+    if (kinds[tail] == RECORD_ADDRESS) {
+      cellAddr = buffer[tail];
+      tail = (tail + 1) & TWI_BUFFER_MASK;
+      continue;
+    }
+
+    uint8_t start = cellAddr;
+    uint8_t n = 0;
+    while (head != tail && kinds[tail] == RECORD_CELL && n < LCD_CHARACTERS_PER_LINE - start % LCD_CHARACTERS_PER_LINE) {
+      run[n++] = buffer[tail];
+      tail = (tail + 1) & TWI_BUFFER_MASK;
+    }
+
+    lcdUpdate(start / LCD_CHARACTERS_PER_LINE + 1, start % LCD_CHARACTERS_PER_LINE + 1, run, n);
+    cellAddr = start + n < LCD_CHARACTERS_PER_SCREEN ? start + n : 0;
+  }
+}
+
+uint8_t twiByteAvailable(void) {
+  applyCells();
+  return head != tail;
+}
+
+uint8_t twiReceiveBacklog(void) {
+  return (head - tail) & TWI_BUFFER_MASK;
+}
+
+uint8_t twiReceiveByte(void) {
+  for (;;) {
+    applyCells();
+
+    cli();
+    if (head != tail) {
+      if (kinds[tail] == RECORD_STREAM)
+        break;
+      sei();                              /* Cell writes arrived meanwhile */
+      continue;
+    }
+
+    sleep_enable();                       /* Sleep until data arrives */
+    sei();                                /* Takes effect after sleep_cpu */
+    sleep_cpu();
+    sleep_disable();
+  }
+
+  uint8_t data = buffer[tail];
+  tail = (tail + 1) & TWI_BUFFER_MASK;
+  sei();
+
+  return data;
+}
+
+uint16_t twiRefusedBytes(void) {
+  cli();
+  uint16_t n = refused;
+  sei();
+  return n;
+}
+
+#endif
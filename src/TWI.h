@@ -0,0 +1,87 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file TWI.h
+ * @brief TWI (I2C) slave reception with a byte stream register and cell addressed registers,
+ *        for many displays sharing one bus.
+ *
+ * Built only when TWI_INPUT_ENABLE is defined (eg. CPPFLAGS += -DTWI_INPUT_ENABLE), which also
+ * makes uart_echo take its input from the TWI instead of the USART.
+ *
+ * The device answers at TWI_ADDRESS. A write transaction starts with a register number followed
+ * by data for it; a read transaction reads from the register last written (a write of just the
+ * register number, then a repeated start). The registers are
+ *
+ *   TWI_REG_STREAM  write: bytes for the terminal (text and escape sequences, as over the USART)
+ *                   read:  the number of records (stream bytes and cell writes) still buffered
+ *   TWI_REG_CURSOR  write: row and column (zero based) of the cell address
+ *                   read:  row and column of the cell address
+ *   TWI_REG_CELLS   write: characters for the cells from the cell address on
+ *                   read:  characters of the cells from the cell address on, as shown
+ *
+ * The cell address advances with every character written or read, continuing onto the next row
+ * and from the end of the screen to its start. Cell writes change the screen without moving the
+ * cursor or scrolling.
+ *
+ * Writes are only buffered by the interrupt, so the bus is held (clock stretched) only briefly
+ * for each byte; the main loop renders them in order. When the buffer is full data bytes are not
+ * acknowledged, and the master should retry them later.
+ */
+
+#ifndef TWI_ADDRESS
+#define TWI_ADDRESS     0x3c    ///< Seven bit slave address
+#endif
+#ifndef TWI_BUFFER_SIZE
+#define TWI_BUFFER_SIZE 32      ///< Write buffer size (holds one less); must be a power of two
+#endif
+#ifndef TWI_BIT_RATE
+#define TWI_BIT_RATE    100000  ///< SCL frequency of the master (for timing estimates only)
+#endif
+
+#define TWI_REG_STREAM  0x00
+#define TWI_REG_CURSOR  0x01
+#define TWI_REG_CELLS   0x02
+
+/**
+   Initialize the TWI as a slave at TWI_ADDRESS. Reception is interrupt driven and sets the sleep
+   mode to idle; global interrupts must be enabled to receive.
+*/
+void initTWISlave(void);
+
+/**
+   Applies the cell writes at the head of the buffer to the LCD, then returns non-zero if a
+   stream byte is waiting to be read.
+*/
+uint8_t twiByteAvailable(void);
+
+/**
+   Returns the number of records (stream bytes and cell writes) waiting in the buffer.
+*/
+uint8_t twiReceiveBacklog(void);
+
+/**
+   Receive a single stream byte, applying cell writes as they come and sleeping (idle mode)
+   until a stream byte is available.
+*/
+uint8_t twiReceiveByte(void);
+
+/**
+   Returns the number of data bytes refused (not acknowledged) so far because the buffer was
+   full.
+*/
+uint16_t twiRefusedBytes(void);
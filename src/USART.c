@@ -22,13 +22,36 @@
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <string.h>
 #include "USART.h"
+#include "profile.h"
 #include <util/setbaud.h>
 
 #ifndef BAUD                          /* if not defined in Makefile... */
 #define BAUD  9600                     /* set a safe default baud rate */
 #endif
 
+#ifndef USART_RECEIVE_DATA            /* overridden by host (off-target) builds */
+#define USART_RECEIVE_DATA()      UDR0
+#define USART_TRANSMIT_DATA(data) (UDR0 = (data))
+#endif
+
+#define USART_TX_BUFFER_MASK (USART_TX_BUFFER_SIZE - 1)
+#define USART_RX_BUFFER_MASK (USART_RX_BUFFER_SIZE - 1)
+
+static volatile uint8_t txBuffer[USART_TX_BUFFER_SIZE];
+static volatile uint8_t txHead;           /* next free slot (written by caller) */
+static volatile uint8_t txTail;           /* next byte to send (written by ISR) */
+
+static volatile uint8_t rxBuffer[USART_RX_BUFFER_SIZE];
+static volatile uint8_t rxHead;           /* next free slot (written by ISR) */
+static volatile uint8_t rxTail;           /* next byte to read (written by caller) */
+static volatile uint16_t rxOverruns;      /* bytes lost (receive buffer or USART overrun) */
+
+static void (*receiveHandler)(uint8_t);
+
 void initUSART(void) {                                /* requires BAUD */
   UBRR0H = UBRRH_VALUE;                        /* defined in setbaud.h */
   UBRR0L = UBRRL_VALUE;
@@ -38,15 +61,53 @@ void initUSART(void) {                                /* requires BAUD */
   UCSR0A &= ~(1 << U2X0);
 #endif
                                   /* Enable USART transmitter/receiver */
-  UCSR0B = (1 << TXEN0) | (1 << RXEN0);
+  UCSR0B = (1 << TXEN0) | (1 << RXEN0) | (1 << RXCIE0);
   UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);   /* 8 data bits, 1 stop bit */
+
+  set_sleep_mode(SLEEP_MODE_IDLE);     /* receiveByte sleeps; the USART keeps running */
+}
+
+void setUSARTReceiveHandler(void (*handler)(uint8_t)) {
+  receiveHandler = handler;
 }
 
 
 void transmitByte(uint8_t data) {
-                                     /* Wait for empty transmit buffer */
-  loop_until_bit_is_set(UCSR0A, UDRE0);
-  UDR0 = data;                                            /* send data */
+  uint8_t sreg = SREG;
+  uint8_t next;
+
+  /* The buffer is shared with interrupt handlers (eg. a receive handler
+     echoing input), so claim the slot with interrupts disabled */
+  for (;;) {
+    cli();
+    next = (txHead + 1) & USART_TX_BUFFER_MASK;
+    if (next != txTail) break;                /* Room in the buffer */
+
+    if (!(sreg & (1 << SREG_I))) {
+      /* With interrupts disabled (eg. within an ISR) the buffer can't drain by
+         itself; send the oldest byte by polling instead */
+      if (bit_is_set(UCSR0A, UDRE0)) {
+        USART_TRANSMIT_DATA(txBuffer[txTail]);
+        txTail = (txTail + 1) & USART_TX_BUFFER_MASK;
+      }
+    } else {
+      SREG = sreg;                            /* Let the buffer drain */
+    }
+  }
+
+  txBuffer[txHead] = data;
+  txHead = next;
+  UCSR0B |= (1 << UDRIE0);        /* Data register empty interrupt sends it */
+  SREG = sreg;
+}
+
+ISR(USART_UDRE_vect) {
+  if (txHead == txTail) {
+    UCSR0B &= ~(1 << UDRIE0);          /* Nothing left to send; stop */
+  } else {
+    USART_TRANSMIT_DATA(txBuffer[txTail]);
+    txTail = (txTail + 1) & USART_TX_BUFFER_MASK;
+  }
 }
 
 void transmitString(const char* data) {
@@ -56,7 +117,93 @@ void transmitString(const char* data) {
   }
 }
 
+uint8_t tryTransmitString(const char* data) {
+  uint8_t n = strlen(data);
+  uint8_t sreg = SREG;
+  cli();
+
+  if (((txTail - txHead - 1) & USART_TX_BUFFER_MASK) < n) {
+    SREG = sreg;                              /* No room; don't wait for it */
+    return 0;
+  }
+
+  while (*data != '\0') {
+    txBuffer[txHead] = *data++;
+    txHead = (txHead + 1) & USART_TX_BUFFER_MASK;
+  }
+  UCSR0B |= (1 << UDRIE0);
+  SREG = sreg;
+  return 1;
+}
+
+ISR(USART_RX_vect) {
+  PROFILE_BEGIN(PROFILE_USART_RX);
+
+  if (bit_is_set(UCSR0A, DOR0)) rxOverruns++;  /* Bytes were lost before this one */
+
+  uint8_t data = USART_RECEIVE_DATA();
+  uint8_t next = (rxHead + 1) & USART_RX_BUFFER_MASK;
+
+  if (next == rxTail) {
+    rxOverruns++;                               /* Buffer full; drop the byte */
+  } else {
+    rxBuffer[rxHead] = data;
+    rxHead = next;
+    if (receiveHandler) receiveHandler(data);
+  }
+
+  PROFILE_END(PROFILE_USART_RX);
+}
+
+uint8_t byteAvailable(void) {
+  return rxHead != rxTail;
+}
+
+uint8_t receiveBacklog(void) {
+  return (rxHead - rxTail) & USART_RX_BUFFER_MASK;
+}
+
 uint8_t receiveByte(void) {
-  loop_until_bit_is_set(UCSR0A, RXC0);       /* Wait for incoming data */
-  return UDR0;                                /* return register value */
+  cli();
+  while (rxHead == rxTail) {                 /* Sleep until data arrives */
+    sleep_enable();
+    sei();                                   /* Takes effect after sleep_cpu */
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+
+  uint8_t data = rxBuffer[rxTail];
+  rxTail = (rxTail + 1) & USART_RX_BUFFER_MASK;
+  sei();
+
+  return data;
+}
+
+uint16_t receiveOverruns(void) {
+  cli();
+  uint16_t n = rxOverruns;
+  sei();
+  return n;
+}
+
+static int putUSARTStream(char c, FILE* stream) {
+  if (c == '\n') transmitByte('\r');       /* Terminals expect CR LF */
+  transmitByte(c);
+  return 0;
+}
+
+static int getUSARTStream(FILE* stream) {
+  return receiveByte();
+}
+
+FILE* openUSARTStream(void) {
+  static FILE file;
+  static FILE* stream;
+
+  if (!stream) {
+    stream = &file;
+    fdev_setup_stream(stream, putUSARTStream, getUSARTStream, _FDEV_SETUP_RW);
+  }
+  return stream;
 }
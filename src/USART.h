@@ -22,13 +22,33 @@
  * @brief Functions to initialize, read and write using USART.
  */
 
+#include <stdio.h>
+
+#ifndef USART_TX_BUFFER_SIZE
+#define USART_TX_BUFFER_SIZE 128  ///< Transmit buffer size; must be a power of two (at most 256)
+#endif
+#ifndef USART_RX_BUFFER_SIZE
+#define USART_RX_BUFFER_SIZE 64   ///< Receive buffer size (holds one less); must be a power of two
+#endif
+
 /**
-   Initialize USART hardware.
+   Initialize USART hardware. Reception is interrupt driven (into a buffer of
+   USART_RX_BUFFER_SIZE bytes) and sets the sleep mode to idle; global interrupts must be enabled
+   to send or receive.
 */
 void initUSART(void);
 
 /**
-   Transmit a single byte using USART.
+   Sets a function called from the receive interrupt with each byte as it is queued for
+   receiveByte (bytes lost to overruns are not passed on), or none if handler is null. It runs with
+   interrupts disabled, so should be brief; it may transmit.
+*/
+void setUSARTReceiveHandler(void (*handler)(uint8_t));
+
+/**
+   Transmit a single byte using USART. The byte is queued and sent from the data register empty
+   interrupt, so this only waits when the transmit buffer is full. Global interrupts must be
+   enabled for queued bytes to be sent.
 */
 void transmitByte(uint8_t data);
 
@@ -38,6 +58,35 @@ void transmitByte(uint8_t data);
 void transmitString(const char* data);
 
 /**
-   Receive a single byte using USART
+   Queues a string for transmission only if all of it fits in the transmit buffer, never waiting
+   (so it is safe from interrupt handlers); returns non-zero if it was queued.
+*/
+uint8_t tryTransmitString(const char* data);
+
+/**
+   Returns non-zero if a received byte is waiting to be read.
+*/
+uint8_t byteAvailable(void);
+
+/**
+   Returns the number of received bytes waiting to be read.
+*/
+uint8_t receiveBacklog(void);
+
+/**
+   Receive a single byte using USART, sleeping (idle mode) until one is available.
 */
 uint8_t receiveByte(void);
+
+/**
+   Returns the number of received bytes lost so far, because the receive buffer was full or the
+   USART overran.
+*/
+uint16_t receiveOverruns(void);
+
+/**
+   Returns a stdio stream on the USART (set up by the first call), so that eg. fprintf_P formats
+   straight into the transmit buffer. Writes go through transmitByte, with '\n' sent as "\r\n";
+   reads block in receiveByte.
+*/
+FILE* openUSARTStream(void);
@@ -0,0 +1,38 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file avr/eeprom.h
+ * @brief Host stand in for avr-libc's <avr/eeprom.h> (the functions used by this project).
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define eeprom_is_ready()  halEepromReady()
+#define eeprom_busy_wait() do { } while (!eeprom_is_ready())
+
+#define eeprom_read_byte(p)          halEepromRead((uint16_t) (uintptr_t) (p))
+#define eeprom_write_byte(p, value)  halEepromWrite((uint16_t) (uintptr_t) (p), (value), 0)
+#define eeprom_update_byte(p, value) halEepromWrite((uint16_t) (uintptr_t) (p), (value), 1)
+
+#endif /* HOST_AVR_EEPROM_H */
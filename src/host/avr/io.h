@@ -0,0 +1,190 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file avr/io.h
+ * @brief Host stand in for avr-libc's <avr/io.h> (ATmega328P subset) backed by hal.c.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit)   ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)   do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#define E2END (HAL_EEPROM_SIZE - 1)
+
+/* Registers */
+
+#define PORTB  (*halReg(HAL_PORTB))
+#define DDRB   (*halReg(HAL_DDRB))
+#define PINB   (*halReg(HAL_PINB))
+#define PORTC  (*halReg(HAL_PORTC))
+#define DDRC   (*halReg(HAL_DDRC))
+#define PINC   (*halReg(HAL_PINC))
+#define PORTD  (*halReg(HAL_PORTD))
+#define DDRD   (*halReg(HAL_DDRD))
+#define PIND   (*halReg(HAL_PIND))
+
+#define SREG   (*halReg(HAL_SREG))
+
+#define UDR0   (*halReg(HAL_UDR0))
+#define UCSR0A (*halReg(HAL_UCSR0A))
+#define UCSR0B (*halReg(HAL_UCSR0B))
+#define UCSR0C (*halReg(HAL_UCSR0C))
+#define UBRR0H (*halReg(HAL_UBRR0H))
+#define UBRR0L (*halReg(HAL_UBRR0L))
+
+#define TCCR0A (*halReg(HAL_TCCR0A))
+#define TCCR0B (*halReg(HAL_TCCR0B))
+#define TCNT0  (*halReg(HAL_TCNT0))
+#define OCR0A  (*halReg(HAL_OCR0A))
+#define TIMSK0 (*halReg(HAL_TIMSK0))
+#define TIFR0  (*halReg(HAL_TIFR0))
+
+#define TCCR1A (*halReg(HAL_TCCR1A))
+#define TCCR1B (*halReg(HAL_TCCR1B))
+#define TCNT1L (*halReg(HAL_TCNT1L))
+#define TCNT1H (*halReg(HAL_TCNT1H))
+#define TCNT1  (*(volatile uint16_t*) halReg(HAL_TCNT1L))
+#define TIMSK1 (*halReg(HAL_TIMSK1))
+#define TIFR1  (*halReg(HAL_TIFR1))
+
+#define SPCR   (*halReg(HAL_SPCR))
+#define SPSR   (*halReg(HAL_SPSR))
+#define SPDR   (*halReg(HAL_SPDR))
+
+#define TWBR   (*halReg(HAL_TWBR))
+#define TWSR   (*halReg(HAL_TWSR))
+#define TWAR   (*halReg(HAL_TWAR))
+#define TWDR   (*halReg(HAL_TWDR))
+#define TWCR   (*halReg(HAL_TWCR))
+
+#define MCUSR  (*halReg(HAL_MCUSR))
+#define WDTCSR (*halReg(HAL_WDTCSR))
+
+/* USART data register access; reads and writes have different effects so the firmware goes
+   through these (see USART.c) */
+#define USART_RECEIVE_DATA()      halUsartReceive()
+#define USART_TRANSMIT_DATA(data) halUsartTransmit(data)
+
+/* Likewise for the SPI data register (see SPI.c) */
+#define SPI_RECEIVE_DATA()        halSpiReceive()
+#define SPI_TRANSMIT_DATA(data)   halSpiTransmit(data)
+
+/* The model keeps TWINT apart from TWCR, so that writing it can be told apart (see lcdLib.c) */
+#define TWI_INTERRUPT_FLAG()      halTwiInterrupt()
+
+/* Pins */
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/* Register bits */
+
+#define SREG_I  7
+
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+#define MPCM0   0
+
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ02  2
+
+#define UCSZ01  2
+#define UCSZ00  1
+
+#define WGM01   1
+#define CS02    2
+#define CS01    1
+#define CS00    0
+#define OCIE0A  1
+#define OCF0A   1
+
+#define CS12    2
+#define CS11    1
+#define CS10    0
+#define TOIE1   0
+#define TOV1    0
+
+#define SPIE    7
+#define SPE     6
+#define DORD    5
+#define MSTR    4
+#define CPOL    3
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+#define SPIF    7
+#define SPI2X   0
+
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+#define TWPS1   1
+#define TWPS0   0
+
+#define WDRF    3
+#define WDIE    6
+#define WDCE    4
+#define WDE     3
+
+#endif /* HOST_AVR_IO_H */
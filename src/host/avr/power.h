@@ -0,0 +1,29 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file avr/power.h
+ * @brief Host stand in for avr-libc's <avr/power.h>; the simulated clock always runs at F_CPU.
+ */
+
+#ifndef HOST_AVR_POWER_H
+#define HOST_AVR_POWER_H
+
+#define clock_div_1 0
+#define clock_prescale_set(div) ((void) (div))
+
+#endif /* HOST_AVR_POWER_H */
@@ -0,0 +1,43 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file avr/wdt.h
+ * @brief Host stand in for avr-libc's <avr/wdt.h>. The watchdog is not modelled; enabling it
+ *        only sets WDTCSR.
+ */
+
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#include <avr/io.h>
+
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+
+#define wdt_enable(timeout) (WDTCSR = (1 << WDE) | (timeout))
+#define wdt_disable()       (WDTCSR = 0)
+#define wdt_reset()         do { } while (0)
+
+#endif /* HOST_AVR_WDT_H */
@@ -0,0 +1,143 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: bench.c
+ *
+ * Throughput benchmark of the echo pipeline: runs the uart_echo firmware (main loop, USART and
+ * lcdLib) on the host against the HD44780 model with representative workloads and reports
+ * simulated CPU cycles, LCD bus transactions and the highest baud rate at which the firmware
+ * keeps up with a continuous stream of the workload.
+ *
+ * Echoed bytes are transmitted instantaneously so that the figures reflect processing (parsing
+ * and LCD) cost alone; the echo column gives the bytes sent back per byte received, which bounds
+ * the rate separately when both directions share the same baud rate.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "harness.h"
+#include "lcdLib.h"
+#include "profile.h"
+#include "workloads.h"
+
+//---------------------------------------------------------------------------------------------
+
+static const uint8_t* workload;
+static size_t workloadLength;
+static uint64_t startCycles, endCycles;
+static hd44780Stats startStats, endStats;
+static uint64_t rxBytes, txBytes;
+
+#ifdef PROFILE_ENABLE
+static char profile[512];
+static size_t profileLength;
+
+/*
+  Collects the profile dumped by the firmware (see profile.h), indenting each line.
+ */
+static void collectProfile(uint8_t c) {
+  if (profileLength + 3 >= sizeof(profile) || c == '\r') return;
+  if (profileLength == 0 || profile[profileLength - 1] == '\n') {
+    profile[profileLength++] = ' ';
+    profile[profileLength++] = ' ';
+  }
+  profile[profileLength++] = c;
+  profile[profileLength] = '\0';
+}
+#endif
+
+/*
+  The first idle (after the firmware has initialized) queues the workload; the second (once the
+  workload has been consumed) records the results and, when profiling, requests the firmware's
+  profile; the next stops the run.
+ */
+static uint8_t onIdle(uint16_t call) {
+  switch (call) {
+  case 0:
+    startCycles = hal.cycles;
+    startStats = hal.lcd.stats;
+    halUsartInput(workload, workloadLength);
+    return 1;
+  case 1:
+    endCycles = hal.cycles;
+    endStats = hal.lcd.stats;
+    rxBytes = hal.rxBytes;
+    txBytes = hal.txBytes;
+#ifdef PROFILE_ENABLE
+    profileLength = 0;
+    halSetTransmitHandler(collectProfile);
+    halUsartInput((const uint8_t*) PROFILE_DUMP_SEQUENCE, strlen(PROFILE_DUMP_SEQUENCE));
+    return 1;
+#endif
+  default:
+    halSetTransmitHandler(0);
+    return 0;
+  }
+}
+
+int main(void) {
+#if defined (PCF8574_MODE)
+  const char* mode = "PCF8574_MODE";
+#elif defined (HC595_MODE)
+  const char* mode = "HC595_MODE";
+#elif defined (FOUR_BIT_MODE)
+  const char* mode = "FOUR_BIT_MODE";
+#elif defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
+  const char* mode = "EIGHT_BIT_ARBITRARY_PIN_MODE";
+#else
+  const char* mode = "default (8-bit)";
+#endif
+  printf("uart_echo throughput: %s, %dx%d, F_CPU=%lu\n", mode, LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) F_CPU);
+  printf("%-10s %7s %6s %12s %10s %9s %9s %9s %10s\n", "workload", "bytes", "echo", "cycles", "cyc/byte",
+         "bus ops", "E", "busy viol", "max baud");
+
+  halUsartTransmitPacing(0);
+
+  int status = 0;
+  for (const benchWorkload* w = benchWorkloads; w->name; w++) {
+    uint8_t buf[BENCH_WORKLOAD_MAX];
+    workloadLength = w->generate(buf, sizeof(buf));
+    workload = buf;
+    halReset();
+    harnessRun(onIdle);
+
+    uint64_t cycles = endCycles - startCycles;
+    hd44780Stats s = endStats;
+    uint64_t busOps = (s.instructions + s.dataWrites + s.dataReads + s.statusReads)
+      - (startStats.instructions + startStats.dataWrites + startStats.dataReads + startStats.statusReads);
+
+    printf("%-10s %7zu %6.2f %12llu %10.1f %9llu %9llu %9llu %10.0f\n", w->name, workloadLength,
+           (double) txBytes / workloadLength,
+           (unsigned long long) cycles, (double) cycles / workloadLength,
+           (unsigned long long) busOps, (unsigned long long) (s.eCycles - startStats.eCycles),
+           (unsigned long long) (s.busyViolations - startStats.busyViolations),
+           10.0 * workloadLength * F_CPU / cycles);
+
+#ifdef PROFILE_ENABLE
+    printf("  section count total max\n%s", profile);
+#endif
+
+    if (rxBytes != workloadLength || s.busyViolations || hal.busContention) status = 1;
+  }
+
+  printf("\n");
+  return status;
+}
@@ -0,0 +1,143 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: capture.c
+ *
+ * Records a raw serial input stream (what a host sends to uart_echo) in the capture format of
+ * uecap.h, one record per read.
+ *
+ * Usage: capture [-b baud] [-o file] [device]
+ *
+ * Reads from the given serial device (configured raw at the given baud rate, BAUD by default) or
+ * standard input, until end of file or interrupted. The capture is written to the given file or
+ * standard output.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uecap.h"
+
+//---------------------------------------------------------------------------------------------
+
+static volatile sig_atomic_t stop;
+
+static void onSignal(int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+static uint64_t nowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static speed_t baudSpeed(long baud) {
+  switch (baud) {
+  case 2400: return B2400;
+  case 4800: return B4800;
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  default: return B0;
+  }
+}
+
+int main(int argc, char** argv) {
+  long baud = BAUD;
+  const char* output = 0;
+  const char* device = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      baud = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (argv[i][0] != '-' && !device) {
+      device = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [-b baud] [-o file] [device]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  int fd = STDIN_FILENO;
+  if (device) {
+    struct termios tio;
+    speed_t speed = baudSpeed(baud);
+
+    fd = open(device, O_RDONLY | O_NOCTTY);
+    if (fd < 0 || tcgetattr(fd, &tio) != 0 || speed == B0) {
+      fprintf(stderr, "%s: can't open %s at %ld baud\n", argv[0], device, baud);
+      return 1;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  FILE* out = output ? fopen(output, "wb") : stdout;
+  if (!out || uecapWriteHeader(out) != 0) {
+    fprintf(stderr, "%s: can't write %s\n", argv[0], output ? output : "standard output");
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+
+  uint8_t buf[4096];
+  uint64_t last = nowUs();
+  unsigned long records = 0, bytes = 0;
+
+  while (!stop) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+
+    uint64_t now = nowUs();
+    uint64_t delta = now - last;
+    last = now;
+
+    if (uecapWriteRecord(out, delta > UINT32_MAX ? UINT32_MAX : delta, buf, n) != 0) {
+      fprintf(stderr, "%s: write failed\n", argv[0]);
+      return 1;
+    }
+    fflush(out);
+
+    records++;
+    bytes += n;
+  }
+
+  fprintf(stderr, "%lu records, %lu bytes captured\n", records, bytes);
+  return out == stdout ? 0 : fclose(out) != 0;
+}
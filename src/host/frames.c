@@ -0,0 +1,343 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * File: frames.c
+ *
+ * Refresh rate of a changing dashboard over a slow serial link: runs the uart_echo firmware on
+ * the host with input arriving at the given baud rate (9600 by default) and sends the same
+ * sequence of frames as ANSI escapes (each changed row rewritten after a cursor position), as
+ * full screen packets, and as delta packets (see screenEncoder.h). After each frame the LCD
+ * model is checked against it. Frames are streamed without waiting for acknowledgements.
+ *
+ *   frames [baud]
+ *
+ * Built with SPI_INPUT_ENABLE (frames-spi) the frames are instead sent by an SPI master at the
+ * given rate in bytes per second (by default one every SPI_BYTE_US), which backs off whenever
+ * the status byte shows the firmware's receive buffer over half full (see SPI.h).
+ *
+ *   frames-spi [rate]
+ *
+ * Built with TWI_INPUT_ENABLE (frames-twi) they are written by a TWI master at the given SCL
+ * frequency (TWI_BIT_RATE by default) to the stream register, and in a fourth encoding as the
+ * changed run of each row written to the cell registers (see TWI.h).
+ *
+ *   frames-twi [bitrate]
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "harness.h"
+#include "lcdLib.h"
+#include "USART.h"
+#ifdef SPI_INPUT_ENABLE
+#include "SPI.h"
+#endif
+#ifdef TWI_INPUT_ENABLE
+#include "TWI.h"
+#endif
+#include "screenPacket.h"
+#include "screenEncoder.h"
+
+#define FRAMES 200
+
+#define SPI_HOLD_US 50 // First pause of the SPI master when the receive buffer is over half full
+
+#define FRAME_ANSI   0
+#define FRAME_SCREEN 1
+#define FRAME_DELTA  2
+#define FRAME_CELLS  3 // TWI only
+
+#ifdef TWI_INPUT_ENABLE
+#define LAST_ENCODING FRAME_CELLS
+#else
+#define LAST_ENCODING FRAME_DELTA
+#endif
+
+//---------------------------------------------------------------------------------------------
+
+static char frames[FRAMES][LCD_CHARACTERS_PER_SCREEN];
+
+static uint8_t encoding;
+static uint16_t frameNum;
+static uint8_t input[4 * SCREEN_ENCODER_FRAME_MAX];
+static uint64_t inputBytes, frameNs, busOps;
+static uint64_t startNs, startBusOps;
+static unsigned packets, acks, naks, mismatches;
+
+/*
+  Writes the dashboard shown in frame n (values wander from frame to frame; every 50 frames a
+  different page is shown) to screen.
+ */
+static void generateFrame(uint16_t n, char* screen) {
+  static uint32_t seed = 1;
+  static int cpu = 40, load = 127, mem = 512, rx = 124, tx = 31;
+  char lines[4][48];
+
+  seed = seed * 1103515245 + 12345;
+  cpu = abs(cpu + (int) (seed >> 16) % 7 - 3) % 100;
+  load = abs(load + (int) (seed >> 20) % 11 - 5);
+  mem = mem + (int) (seed >> 24) % 5 - 2;
+  rx = abs(rx + (int) (seed >> 12) % 31 - 15);
+  tx = abs(tx + (int) (seed >> 8) % 9 - 4);
+
+  if (n / 50 % 2 == 0) {
+    snprintf(lines[0], sizeof(lines[0]), "CPU %3d%%  LOAD %d.%02d", cpu, load / 100, load % 100);
+    snprintf(lines[1], sizeof(lines[1]), "MEM %4dM SWAP    0M", mem);
+    snprintf(lines[2], sizeof(lines[2]), "NET %3d.%dk/s %3d.%dk", rx / 10, rx % 10, tx / 10, tx % 10);
+    snprintf(lines[3], sizeof(lines[3]), "UP %02d:%02d:%02d   #%04d", n / 3600, n / 60 % 60, n % 60, n);
+  } else {
+    snprintf(lines[0], sizeof(lines[0]), "DISK /     %3d%% used", 73 + n % 3);
+    snprintf(lines[1], sizeof(lines[1]), "     /home %3d%% used", 41);
+    snprintf(lines[2], sizeof(lines[2]), "TEMP %2d.%dC FAN %4d", 40 + cpu / 10, cpu % 10, 1200 + cpu * 7);
+    snprintf(lines[3], sizeof(lines[3]), "UP %02d:%02d:%02d   #%04d", n / 3600, n / 60 % 60, n % 60, n);
+  }
+
+  memset(screen, ' ', LCD_CHARACTERS_PER_SCREEN);
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES && row < 4; row++) {
+    size_t len = strlen(lines[row]);
+    memcpy(screen + row * LCD_CHARACTERS_PER_LINE, lines[row],
+           len < LCD_CHARACTERS_PER_LINE ? len : LCD_CHARACTERS_PER_LINE);
+  }
+}
+
+/*
+  Encodes frame n (following frame n - 1, or a blank screen) into input, returning the length.
+ */
+static size_t encodeFrame(uint16_t n) {
+  static const char blank[LCD_CHARACTERS_PER_SCREEN];
+  const char* from = n ? frames[n - 1] : 0;
+  const char* to = frames[n];
+  uint8_t* o = input;
+
+  switch (encoding) {
+  case FRAME_ANSI:
+    for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+      const char* line = to + row * LCD_CHARACTERS_PER_LINE;
+      if (from && memcmp(from + row * LCD_CHARACTERS_PER_LINE, line, LCD_CHARACTERS_PER_LINE) == 0)
+        continue;
+      o += sprintf((char*) o, "\e[%d;1H", row + 1);
+      // Writing the last column of the last line would wrap and scroll
+      uint8_t len = row == LCD_NUMBER_OF_LINES - 1 ? LCD_CHARACTERS_PER_LINE - 1 : LCD_CHARACTERS_PER_LINE;
+      memcpy(o, line, len);
+      o += len;
+    }
+    break;
+  case FRAME_SCREEN:
+    o += screenFramePacket(n, SCREEN_PACKET_SCREEN, (const uint8_t*) to, LCD_CHARACTERS_PER_SCREEN, o);
+    break;
+  default:
+    o += screenEncodeUpdate(n ? from : blank, to, LCD_CHARACTERS_PER_SCREEN, n, o);
+  }
+
+  return o - input;
+}
+
+static uint64_t lcdBusOps(void) {
+  hd44780Stats s = hal.lcd.stats;
+  return s.instructions + s.dataWrites + s.dataReads + s.statusReads;
+}
+
+/*
+  Counts the replies to packets.
+ */
+static void collectReply(uint8_t c) {
+  static uint8_t expectSeq;
+
+  if (encoding == FRAME_ANSI)
+    return;
+  if (expectSeq) {
+    expectSeq = 0;
+  } else if (c == SCREEN_PACKET_ACK) {
+    acks++;
+    expectSeq = 1;
+  } else if (c == SCREEN_PACKET_NAK) {
+    naks++;
+    expectSeq = 1;
+  }
+}
+
+/*
+  Checks the LCD against the frame just sent (the last line is not compared in full when sent as
+  ANSI escapes, see encodeFrame).
+ */
+static void checkFrame(uint16_t n) {
+  char screen[LCD_NUMBER_OF_LINES * (LCD_CHARACTERS_PER_LINE + 1)];
+  halRenderLCD(screen);
+
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+    uint8_t len = (encoding == FRAME_ANSI && row == LCD_NUMBER_OF_LINES - 1) ? LCD_CHARACTERS_PER_LINE - 1 : LCD_CHARACTERS_PER_LINE;
+    if (memcmp(screen + row * (LCD_CHARACTERS_PER_LINE + 1), frames[n] + row * LCD_CHARACTERS_PER_LINE, len)) {
+      mismatches++;
+      return;
+    }
+  }
+}
+
+static void sendInput(const uint8_t* data, size_t n) {
+#ifdef SPI_INPUT_ENABLE
+  halSpiInput(data, n);
+#elif defined (TWI_INPUT_ENABLE)
+  halTwiWrite(TWI_ADDRESS, TWI_REG_STREAM, data, n);
+#else
+  halUsartInput(data, n);
+#endif
+}
+
+/*
+  The first idle enters binary mode when sending packets; each following idle checks the frame
+  sent before and queues the next one.
+ */
+#ifdef TWI_INPUT_ENABLE
+/*
+  Writes the changed run of each row of frame n to the cell registers, returning the number of
+  bytes written (register numbers included).
+ */
+static size_t sendCells(uint16_t n) {
+  size_t bytes = 0;
+
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+    const char* line = frames[n] + row * LCD_CHARACTERS_PER_LINE;
+    const char* before = n ? frames[n - 1] + row * LCD_CHARACTERS_PER_LINE : 0;
+    uint8_t first = 0, last = LCD_CHARACTERS_PER_LINE;
+
+    if (before) {
+      while (first < last && line[first] == before[first]) first++;
+      while (last > first && line[last - 1] == before[last - 1]) last--;
+      if (first == last)
+        continue;
+    }
+
+    uint8_t cursor[2] = { row, first };
+    halTwiWrite(TWI_ADDRESS, TWI_REG_CURSOR, cursor, 2);
+    halTwiWrite(TWI_ADDRESS, TWI_REG_CELLS, (const uint8_t*) line + first, last - first);
+    bytes += 2 + sizeof(cursor) + last - first;
+  }
+
+  return bytes;
+}
+#endif
+
+static uint8_t onIdle(uint16_t call) {
+  static uint8_t entered;
+  (void) call;
+
+  if (frameNum == 0 && encoding != FRAME_ANSI && !entered) {
+    entered = 1;
+    sendInput((const uint8_t*) SCREEN_PACKET_SEQUENCE, strlen(SCREEN_PACKET_SEQUENCE));
+    return 1;
+  }
+
+  if (frameNum > 0) {
+    frameNs += halNanoseconds() - startNs;
+    busOps += lcdBusOps() - startBusOps;
+    checkFrame(frameNum - 1);
+  }
+  if (frameNum == FRAMES) {
+    entered = 0;
+    return 0;
+  }
+
+  startNs = halNanoseconds();
+  startBusOps = lcdBusOps();
+#ifdef TWI_INPUT_ENABLE
+  if (encoding == FRAME_CELLS) {
+    inputBytes += sendCells(frameNum++);
+    return 1;
+  }
+#endif
+
+  size_t length = encodeFrame(frameNum++);
+  inputBytes += length;
+  if (length && encoding != FRAME_ANSI)
+    packets++;
+  sendInput(input, length);
+  return 1;
+}
+
+/*
+  Input bytes lost so far, by the USART or SPI model and by the firmware's receive buffer (the
+  TWI master resends the bytes refused by the firmware, so none are lost).
+ */
+static uint64_t lostInput(void) {
+#ifdef SPI_INPUT_ENABLE
+  return hal.spiOverruns + spiReceiveOverruns();
+#elif defined (TWI_INPUT_ENABLE)
+  return 0;
+#else
+  return hal.rxOverruns + receiveOverruns();
+#endif
+}
+
+int main(int argc, char** argv) {
+#ifdef SPI_INPUT_ENABLE
+  uint32_t rate = argc > 1 ? strtoul(argv[1], 0, 10) : 1000000 / SPI_BYTE_US;
+#elif defined (TWI_INPUT_ENABLE)
+  uint32_t bitRate = argc > 1 ? strtoul(argv[1], 0, 10) : TWI_BIT_RATE;
+#else
+  uint32_t baud = argc > 1 ? strtoul(argv[1], 0, 10) : 9600;
+#endif
+  const char* names[] = { "ansi", "screen", "delta", "cells" };
+
+  for (uint16_t n = 0; n < FRAMES; n++)
+    generateFrame(n, frames[n]);
+
+#ifdef SPI_INPUT_ENABLE
+  printf("dashboard refresh: %d frames, %dx%d, SPI at %lu bytes/s\n", FRAMES, LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) rate);
+#elif defined (TWI_INPUT_ENABLE)
+  printf("dashboard refresh: %d frames, %dx%d, TWI at %lu Hz\n", FRAMES, LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) bitRate);
+#else
+  printf("dashboard refresh: %d frames, %dx%d, %lu baud\n", FRAMES, LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) baud);
+#endif
+  printf("%-8s %10s %10s %10s %10s %6s %6s %6s\n", "encoding", "bytes/fr", "ms/frame", "frames/s", "bus/fr", "nak", "lost", "bad");
+
+  halSetTransmitHandler(collectReply);
+  halUsartTransmitPacing(0);
+
+  int status = 0;
+  for (encoding = FRAME_ANSI; encoding <= LAST_ENCODING; encoding++) {
+    frameNum = 0;
+    inputBytes = frameNs = busOps = 0;
+    packets = acks = naks = mismatches = 0;
+
+    halReset();
+    uint64_t lost = lostInput();
+#ifdef SPI_INPUT_ENABLE
+    halSpiPacing(rate, SPI_RX_BUFFER_SIZE / 2, SPI_HOLD_US);
+#elif defined (TWI_INPUT_ENABLE)
+    halTwiPacing(bitRate);
+#else
+    halUsartPacing(baud);
+#endif
+    harnessRun(onIdle);
+    lost = lostInput() - lost;
+
+    double ms = frameNs / 1e6 / FRAMES;
+    printf("%-8s %10.1f %10.2f %10.1f %10.1f %6u %6lu %6u\n", names[encoding], (double) inputBytes / FRAMES,
+           ms, 1000.0 / ms, (double) busOps / FRAMES, naks, (unsigned long) lost, mismatches);
+
+    if (naks || lost || mismatches || (encoding != FRAME_ANSI && acks != packets))
+      status = 1;
+  }
+
+  return status;
+}
@@ -0,0 +1,923 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: hal.c
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#define _GNU_SOURCE                    // fopencookie
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "hal.h"
+
+//---------------------------------------------------------------------------------------------
+// Interrupt vectors (defined by the firmware through ISR(); absent vectors are null)
+
+void USART_RX_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void SPI_STC_vect(void) __attribute__((weak));
+void TWI_vect(void) __attribute__((weak));
+
+//---------------------------------------------------------------------------------------------
+// Static global variables
+
+halState hal;
+
+static volatile uint8_t regs[HAL_REGISTER_COUNT];
+static halLCDPins lcdPins;
+static uint8_t inInterrupt;
+static uint8_t sleeping;
+static uint8_t lcdWasDriving;
+
+static jmp_buf haltJmp;
+static uint8_t running;
+
+static void (*transmitHandler)(uint8_t);
+static uint8_t (*idleHandler)(void);
+
+// USART model
+static uint8_t* rxInput;           // queued input
+static uint64_t* rxArrival;        // arrival cycle of each queued byte (paced mode)
+static size_t rxLength, rxCapacity;
+static size_t rxNext;              // next input byte to arrive
+static uint8_t rxFifo[2];          // receive data register (two level FIFO)
+static uint8_t rxCount;
+static uint32_t rxBaud;
+static uint32_t txBaud = BAUD;
+static uint32_t rxIdlePolls;
+static uint64_t txBusyUntil;
+
+// SPI model (slave; the master is simulated)
+static uint8_t* spiInput;          // queued bytes for the master to send
+static size_t spiLength, spiCapacity;
+static size_t spiNext;             // next byte to send
+static uint64_t spiNextAt;         // cycle at which its transfer completes
+static uint64_t spiPeriod;         // cycles between transfers
+static uint64_t spiHold;           // extra cycles waited when the status is above spiLimit
+static uint8_t spiBackoff;         // and the number of times in a row it has been
+static uint8_t spiLimit = 0xff;
+static uint8_t spiReceived;        // SPDR as read (the last byte received)
+static uint8_t spiOut;             // SPDR as written (the next byte to shift out)
+static void (*spiHandler)(uint8_t);
+
+// SPI master (the firmware shifting bytes into the shift register driving the LCD)
+static uint8_t spiMasterByte;      // the byte being shifted out
+static uint64_t spiMasterAt;       // cycle at which it is in the shift register, or 0
+static uint8_t spiShift;           // shift register contents (latched onto HAL_EXPANDER)
+static uint8_t latchWas;
+
+// TWI model (slave; the master is simulated)
+#define TWI_START 0                // data: address and direction (SLA+R/W)
+#define TWI_WRITE 1                // data: the byte written
+#define TWI_READ  2                // data: non-zero for the last byte read (NACKed)
+#define TWI_STOP  3
+
+typedef struct {
+  uint8_t type, data;
+} twiItem;
+
+static twiItem* twiItems;          // queued bus operations of the master
+static size_t twiLength, twiCapacity;
+static size_t twiNext;             // next operation
+static uint64_t twiNextAt;         // cycle at which it completes
+static uint64_t twiBitCycles = F_CPU / 100000;
+static uint8_t twiInt;             // TWINT: the slave holds SCL low until the firmware clears it
+static uint64_t twiIntAt;
+static uint8_t twiAck;             // TWEA as of the last clearing of TWINT
+static uint8_t twiAddressed;
+static size_t twiStart;            // the start of the current transaction
+static size_t twiRetry;            // one past a refused data byte to send again, or 0
+static void (*twiHandler)(uint8_t);
+
+// TWI master (the firmware addressing devices; only the LCD expander answers)
+static uint8_t twiMaster;          // between the firmware's START and STOP
+static uint8_t twiMasterPending;   // a START or byte under way, completing at twiMasterAt
+static uint8_t twiMasterStart;     // which is a START
+static uint8_t twiMasterByte;      // or this byte
+static uint8_t twiMasterStatus;    // status raised last
+static uint8_t twiMasterAck;       // the device addressed acknowledged
+static uint64_t twiMasterAt;
+static uint64_t twiStopAt;         // TWSTO clears (the STOP condition has been sent)
+
+// EEPROM model
+uint8_t halEeprom[HAL_EEPROM_SIZE] = { [0 ... HAL_EEPROM_SIZE - 1] = 0xff };
+static uint64_t eepromBusyUntil;
+
+// Timer0 model (CTC mode only)
+static uint64_t timer0Synced;      // cycle up to which Timer0 has been advanced
+
+// Timer1 model (normal mode only)
+static uint64_t timer1Synced;      // cycle up to which Timer1 has been advanced
+
+//---------------------------------------------------------------------------------------------
+// Static functions
+
+static uint64_t byteCycles(uint32_t baud) {
+  return baud ? (uint64_t) F_CPU * 10 / baud : 0;
+}
+
+static uint8_t pinLevel(const halPin* p) {
+  return p->port >= 0 && (regs[p->port] & (1 << p->bit));
+}
+
+/*
+  Pass the current levels of the LCD interface lines to the LCD model, then recompute the PIN
+  registers from the port outputs and whatever the LCD drives on the data lines.
+ */
+static void syncPins(void) {
+  uint8_t latch = pinLevel(&lcdPins.latch);
+  if (latch && !latchWas)
+    regs[HAL_EXPANDER] = spiShift;
+  latchWas = latch;
+
+  uint8_t data = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    if (pinLevel(&lcdPins.data[i])) data |= (1 << i);
+
+  uint8_t rs = pinLevel(&lcdPins.rs), rw = pinLevel(&lcdPins.rw), e = pinLevel(&lcdPins.e);
+  if (rs != hal.lcd.rs || rw != hal.lcd.rw || e != hal.lcd.e || data != hal.lcd.data)
+    hd44780Pins(&hal.lcd, halNanoseconds(), rs, rw, e, data);
+
+  regs[HAL_PINB] = regs[HAL_PORTB] & regs[HAL_DDRB];
+  regs[HAL_PINC] = regs[HAL_PORTC] & regs[HAL_DDRC];
+  regs[HAL_PIND] = regs[HAL_PORTD] & regs[HAL_DDRD];
+
+  uint8_t out;
+  uint8_t driving = hd44780Output(&hal.lcd, &out);
+  if (driving) {
+    uint8_t contention = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+      const halPin* p = &lcdPins.data[i];
+      if (p->port < 0) continue;
+
+      if (regs[p->ddr] & (1 << p->bit)) {
+        contention = 1;
+      } else if (out & (1 << i)) {
+        regs[p->pin] |= (1 << p->bit);
+      }
+    }
+
+    if (contention && !lcdWasDriving) hal.busContention++;
+  }
+  lcdWasDriving = driving;
+}
+
+/*
+  Move input bytes that have arrived into the receive FIFO and update the USART status flags.
+ */
+static void syncUsart(void) {
+  if (rxBaud) {
+    while (rxNext < rxLength && rxArrival[rxNext] <= hal.cycles) {
+      if (rxCount < sizeof(rxFifo)) {
+        rxFifo[rxCount++] = rxInput[rxNext];
+      } else {
+        hal.rxOverruns++;
+        regs[HAL_UCSR0A] |= (1 << DOR0);
+      }
+      rxNext++;
+    }
+  } else if (!(regs[HAL_UCSR0B] & (1 << RXCIE0)) || sleeping) {
+    // Unpaced input is offered whenever the firmware looks for it: on polling, or when sleeping
+    // if reception is interrupt driven (so that its receive buffer never overflows)
+    while (rxNext < rxLength && rxCount < sizeof(rxFifo))
+      rxFifo[rxCount++] = rxInput[rxNext++];
+  }
+
+  if (rxCount) {
+    regs[HAL_UCSR0A] |= (1 << RXC0);
+  } else {
+    regs[HAL_UCSR0A] &= ~(1 << RXC0);
+  }
+
+  // The transmit data register is empty once at most one byte remains in the shift register
+  if (txBusyUntil <= hal.cycles + byteCycles(txBaud)) {
+    regs[HAL_UCSR0A] |= (1 << UDRE0);
+  } else {
+    regs[HAL_UCSR0A] &= ~(1 << UDRE0);
+  }
+}
+
+/*
+  Complete the SPI transfers that are due. As master, the firmware's byte ends up in the shift
+  register. As slave, the master's byte is received (and lost if the previous one has not been
+  taken yet) while the byte last written to SPDR goes to the master; whenever that status is
+  above spiLimit the master holds off, twice as long each time in a row.
+ */
+static void syncSpi(void) {
+  if (spiMasterAt && spiMasterAt <= hal.cycles) {
+    spiShift = spiMasterByte;
+    spiMasterAt = 0;
+    regs[HAL_SPSR] |= (1 << SPIF);
+  }
+
+  while (spiNext < spiLength && spiNextAt <= hal.cycles) {
+    uint8_t miso = spiOut;
+
+    if (!(regs[HAL_SPCR] & (1 << SPE)) || (regs[HAL_SPSR] & (1 << SPIF))) {
+      hal.spiOverruns++;
+    } else {
+      spiReceived = spiInput[spiNext];
+      regs[HAL_SPSR] |= (1 << SPIF);
+    }
+    hal.spiBytes++;
+    spiNext++;
+
+    if (spiHandler)
+      spiHandler(miso);
+
+    spiNextAt += spiPeriod;
+    if (miso > spiLimit) {
+      spiNextAt += spiHold << spiBackoff;
+      if (spiBackoff < 10) spiBackoff++;
+    } else {
+      spiBackoff = 0;
+    }
+  }
+}
+
+static uint64_t twiItemCycles(size_t i) {
+  if (i >= twiLength) return 0;
+  return twiBitCycles * (twiItems[i].type == TWI_START ? 10 : twiItems[i].type == TWI_STOP ? 2 : 9);
+}
+
+/*
+  Set TWINT with the given slave status. The model keeps TWINT in twiInt rather than in TWCR, so
+  that a write of TWINT to TWCR (which clears it on the MCU) can be told apart; until then the
+  slave holds SCL low.
+ */
+static void twiRaise(uint8_t status) {
+  regs[HAL_TWSR] = status | (regs[HAL_TWSR] & 0x03);
+  twiInt = 1;
+  twiIntAt = hal.cycles;
+}
+
+/*
+  Act on a write of TWINT by the firmware as master: send a STOP and/or (repeated) START, or the
+  byte in TWDR, at the SCL frequency set by TWBR and the prescaler.
+ */
+static void twiMasterCommand(void) {
+  uint8_t control = regs[HAL_TWCR];
+  uint64_t from = hal.cycles;
+  uint64_t bit = 16 + 2 * (uint64_t) regs[HAL_TWBR] * (1 << 2 * (regs[HAL_TWSR] & 0x03));
+
+  if (control & (1 << TWSTO)) {
+    twiMaster = 0;
+    twiStopAt = hal.cycles + bit * 2;
+    from = twiStopAt;
+  }
+
+  if (control & (1 << TWSTA)) {
+    twiMasterStart = 1;
+    twiMasterAt = from + bit;
+    twiMasterPending = 1;
+    hal.twiTransactions++;
+  } else if (twiMaster) {
+    twiMasterStart = 0;
+    twiMasterByte = regs[HAL_TWDR];
+    twiMasterAt = from + bit * 9;
+    twiMasterPending = 1;
+    hal.twiMasterBytes++;
+  }
+}
+
+/*
+  Complete the START or byte the firmware is sending as master. The PCF8574 driving the LCD (if
+  any) acknowledges its address and sets its outputs to each data byte as it acknowledges it.
+ */
+static void twiMasterComplete(void) {
+  twiMasterPending = 0;
+
+  if (twiMasterStart) {
+    twiMasterStatus = twiMaster ? 0x10 : 0x08;
+    twiMaster = 1;
+  } else if (twiMasterStatus == 0x08 || twiMasterStatus == 0x10) {
+    twiMasterAck = halLCDExpanderAddress && twiMasterByte == (halLCDExpanderAddress << 1);
+    twiMasterStatus = twiMasterAck ? 0x18 : 0x20;
+  } else {
+    if (twiMasterAck)
+      regs[HAL_EXPANDER] = twiMasterByte;
+    twiMasterStatus = twiMasterAck ? 0x28 : 0x30;
+  }
+  twiRaise(twiMasterStatus);
+}
+
+/*
+  Release the bus once the firmware has cleared TWINT, then carry out the master's due bus
+  operations up to the next one the slave has to respond to. A data byte the slave does not
+  acknowledge ends the transaction; after a pause of 100 bit times the master sends the register
+  number again, followed by the refused byte and the rest.
+ */
+static void syncTwi(void) {
+  if (twiStopAt && twiStopAt <= hal.cycles) {
+    regs[HAL_TWCR] &= ~(1 << TWSTO);
+    twiStopAt = 0;
+  }
+
+  if (regs[HAL_TWCR] & (1 << TWINT)) {
+    uint8_t released = twiInt;
+    regs[HAL_TWCR] &= ~(1 << TWINT);
+    twiInt = 0;
+    if (released)
+      hal.twiStretch += hal.cycles - twiIntAt;
+
+    if (twiMaster || (regs[HAL_TWCR] & ((1 << TWSTA) | (1 << TWSTO)))) {
+      twiMasterCommand();
+    } else if (released) {
+      twiAck = regs[HAL_TWCR] & (1 << TWEA);
+      twiNextAt = hal.cycles + twiItemCycles(twiNext);
+    }
+  }
+
+  if (twiMasterPending && twiMasterAt <= hal.cycles)
+    twiMasterComplete();
+
+  while (!twiInt && twiNext < twiLength && twiNextAt <= hal.cycles) {
+    twiItem item = twiItems[twiNext++];
+
+    switch (item.type) {
+    case TWI_START:
+      if (twiAddressed) { // Repeated start; addressed again once the firmware has seen the stop
+        twiAddressed = 0;
+        twiNext--;
+        twiRaise(0xa0);
+        break;
+      }
+      twiStart = twiNext - 1;
+      if ((regs[HAL_TWCR] & (1 << TWEN)) && (regs[HAL_TWCR] & (1 << TWEA)) &&
+          (item.data >> 1) == (regs[HAL_TWAR] >> 1)) {
+        twiAddressed = 1;
+        twiRaise(item.data & 1 ? 0xa8 : 0x60);
+      } else {
+        hal.twiNacks++;
+        while (twiNext < twiLength && twiItems[twiNext].type != TWI_STOP) twiNext++;
+      }
+      break;
+    case TWI_WRITE:
+      regs[HAL_TWDR] = item.data;
+      hal.twiBytes++;
+      if (twiAck) {
+        twiRaise(0x80);
+        break;
+      }
+      twiRaise(0x88);
+      twiAddressed = 0;
+      hal.twiNacks++;
+      twiRetry = twiNext;
+      while (twiNext < twiLength && twiItems[twiNext].type != TWI_STOP) twiNext++;
+      break;
+    case TWI_READ:
+      if (twiHandler) twiHandler(regs[HAL_TWDR]);
+      twiRaise(item.data ? 0xc0 : 0xb8);
+      if (item.data) twiAddressed = 0;
+      break;
+    case TWI_STOP:
+      if (twiAddressed) {
+        twiAddressed = 0;
+        twiRaise(0xa0);
+      }
+      if (twiRetry) {
+        // Resend from the refused byte, behind a start and the register number (which take the
+        // places of the two operations before it); refused at once, resend the whole transaction
+        size_t refused = twiRetry - 1;
+        if (refused >= twiStart + 2) {
+          twiItems[refused - 1] = twiItems[twiStart + 1];
+          twiItems[refused - 2] = twiItems[twiStart];
+          twiNext = refused - 2;
+        } else {
+          twiNext = twiStart;
+        }
+        twiRetry = 0;
+        twiNextAt += twiBitCycles * 100;
+      }
+      break;
+    }
+
+    if (!twiInt)
+      twiNextAt += twiItemCycles(twiNext);
+  }
+}
+
+static const uint16_t timerPrescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+/*
+  Advance Timer0 by the cycles elapsed since it was last brought up to date, setting the compare
+  match flag (and clearing the count) each time it passes OCR0A.
+ */
+static void syncTimer0(void) {
+  uint16_t prescale = timerPrescalers[regs[HAL_TCCR0B] & 0x07];
+
+  if (!prescale) {
+    timer0Synced = hal.cycles;
+    return;
+  }
+
+  uint64_t ticks = (hal.cycles - timer0Synced) / prescale;
+  timer0Synced += ticks * prescale;
+
+  uint64_t count = regs[HAL_TCNT0] + ticks;
+  uint16_t top = regs[HAL_OCR0A] + 1;
+  if (count >= top) {
+    regs[HAL_TIFR0] |= (1 << OCF0A);
+    count %= top;
+  }
+  regs[HAL_TCNT0] = count;
+}
+
+/*
+  Returns the cycle at which Timer0 next matches OCR0A, or UINT64_MAX if it is stopped.
+ */
+static uint64_t timer0MatchAt(void) {
+  uint16_t prescale = timerPrescalers[regs[HAL_TCCR0B] & 0x07];
+
+  if (!prescale)
+    return UINT64_MAX;
+  return timer0Synced + (uint64_t) (regs[HAL_OCR0A] + 1 - regs[HAL_TCNT0]) * prescale;
+}
+
+/*
+  Advance Timer1 by the cycles elapsed since it was last brought up to date, setting the overflow
+  flag when it wraps.
+ */
+static void syncTimer1(void) {
+  uint16_t prescale = timerPrescalers[regs[HAL_TCCR1B] & 0x07];
+
+  if (!prescale) {
+    timer1Synced = hal.cycles;
+    return;
+  }
+
+  uint64_t ticks = (hal.cycles - timer1Synced) / prescale;
+  timer1Synced += ticks * prescale;
+
+  uint32_t count = (regs[HAL_TCNT1H] << 8 | regs[HAL_TCNT1L]) + ticks;
+  if (ticks > 0xffff || count > 0xffff)
+    regs[HAL_TIFR1] |= (1 << TOV1);
+  regs[HAL_TCNT1L] = count & 0xff;
+  regs[HAL_TCNT1H] = (count >> 8) & 0xff;
+}
+
+static void callInterrupt(void (*vector)(void)) {
+  inInterrupt = 1;
+  regs[HAL_SREG] &= ~(1 << SREG_I);
+  hal.cycles += 10; // Interrupt entry and exit
+  vector();
+  regs[HAL_SREG] |= (1 << SREG_I);
+  inInterrupt = 0;
+}
+
+static void dispatchInterrupts(void) {
+  if (inInterrupt || !(regs[HAL_SREG] & (1 << SREG_I)))
+    return;
+
+  // In order of vector priority
+  if (SPI_STC_vect && (regs[HAL_SPCR] & (1 << SPIE)) && (regs[HAL_SPSR] & (1 << SPIF))) {
+    regs[HAL_SPSR] &= ~(1 << SPIF); // Cleared by executing the vector
+    callInterrupt(SPI_STC_vect);
+  } else if (USART_RX_vect && (regs[HAL_UCSR0B] & (1 << RXCIE0)) && (regs[HAL_UCSR0A] & (1 << RXC0))) {
+    callInterrupt(USART_RX_vect);
+  } else if (USART_UDRE_vect && (regs[HAL_UCSR0B] & (1 << UDRIE0)) && (regs[HAL_UCSR0A] & (1 << UDRE0))) {
+    callInterrupt(USART_UDRE_vect);
+  } else if (TIMER1_OVF_vect && (regs[HAL_TIMSK1] & (1 << TOIE1)) && (regs[HAL_TIFR1] & (1 << TOV1))) {
+    regs[HAL_TIFR1] &= ~(1 << TOV1); // Cleared by executing the vector
+    callInterrupt(TIMER1_OVF_vect);
+  } else if (TIMER0_COMPA_vect && (regs[HAL_TIMSK0] & (1 << OCIE0A)) && (regs[HAL_TIFR0] & (1 << OCF0A))) {
+    regs[HAL_TIFR0] &= ~(1 << OCF0A); // Cleared by executing the vector
+    callInterrupt(TIMER0_COMPA_vect);
+  } else if (TWI_vect && (regs[HAL_TWCR] & (1 << TWIE)) && twiInt && !(regs[HAL_TWCR] & (1 << TWINT))) {
+    callInterrupt(TWI_vect);
+  }
+}
+
+/*
+  The firmware is waiting for input. When none is left (and interrupt driven transmission has
+  drained, so the firmware's state is settled) give the idle handler a chance to queue more; stop
+  the run otherwise.
+ */
+static void inputIdle(void) {
+  if (rxNext < rxLength || rxCount || (regs[HAL_UCSR0B] & (1 << UDRIE0)))
+    return;
+  if (spiNext < spiLength || spiMasterAt)
+    return;
+  if ((regs[HAL_SPSR] & (1 << SPIF)) && !(regs[HAL_SPCR] & (1 << MSTR)))
+    return;
+  if (twiNext < twiLength || twiInt || twiMaster || twiMasterPending)
+    return;
+
+  if (!(idleHandler && idleHandler()) && running)
+    longjmp(haltJmp, 1);
+
+  rxIdlePolls = 0;
+}
+
+static void update(void) {
+  syncPins();
+  syncUsart();
+  syncSpi();
+  syncTwi();
+  syncTimer0();
+  syncTimer1();
+  dispatchInterrupts();
+}
+
+//---------------------------------------------------------------------------------------------
+// Firmware facing functions
+
+volatile uint8_t* halReg(halRegister reg) {
+  hal.cycles += HAL_ACCESS_CYCLES;
+  hal.accesses++;
+  update();
+
+  // Polling an empty receiver is how the firmware waits for input
+  if (reg == HAL_UCSR0A && !(regs[HAL_UCSR0A] & (1 << RXC0)) && !inInterrupt) {
+    if (++rxIdlePolls >= HAL_IDLE_POLLS) {
+      inputIdle();
+      syncUsart();
+    }
+  }
+
+  return &regs[reg];
+}
+
+uint8_t halUsartReceive(void) {
+  halReg(HAL_UDR0);
+
+  uint8_t data = rxFifo[0];
+  if (rxCount) {
+    rxFifo[0] = rxFifo[1];
+    rxCount--;
+    hal.rxBytes++;
+
+    uint64_t gap = hal.cycles - hal.rxLastRead;
+    if (hal.rxBytes > 1 && gap > hal.rxMaxGap) {
+      hal.rxMaxGap = gap;
+      hal.rxMaxGapAt = hal.rxBytes - 1;
+    }
+    hal.rxLastRead = hal.cycles;
+  }
+
+  rxIdlePolls = 0;
+  regs[HAL_UCSR0A] &= ~(1 << DOR0);
+  syncUsart();
+  return data;
+}
+
+void halUsartTransmit(uint8_t data) {
+  halReg(HAL_UDR0);
+
+  uint64_t start = txBusyUntil > hal.cycles ? txBusyUntil : hal.cycles;
+  txBusyUntil = start + byteCycles(txBaud);
+  hal.txBytes++;
+  syncUsart();
+
+  if (transmitHandler)
+    transmitHandler(data);
+}
+
+uint8_t halSpiReceive(void) {
+  halReg(HAL_SPDR);
+  return spiReceived;
+}
+
+void halSpiTransmit(uint8_t data) {
+  halReg(HAL_SPDR);
+  spiOut = data;
+
+  // As master the write starts a transfer at the SCK frequency set by SPR1:0 and SPI2X (and
+  // clears SPIF, which the firmware has read last)
+  uint8_t control = regs[HAL_SPCR];
+  if ((control & (1 << SPE)) && (control & (1 << MSTR)) && !spiMasterAt) {
+    static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+    uint8_t divider = dividers[control & ((1 << SPR1) | (1 << SPR0))];
+    if (regs[HAL_SPSR] & (1 << SPI2X)) divider /= 2;
+
+    regs[HAL_SPSR] &= ~(1 << SPIF);
+    spiMasterByte = data;
+    spiMasterAt = hal.cycles + 8 * divider;
+    hal.spiMasterBytes++;
+  }
+}
+
+uint8_t halTwiInterrupt(void) {
+  halReg(HAL_TWCR);
+  return twiInt;
+}
+
+void halDelayUs(double us) {
+  update(); // Takes an interrupt left pending by a cli section that just ended
+
+  uint64_t cycles = (uint64_t) (us * (F_CPU / 1000000.0) + 0.5);
+  hal.delayCycles += cycles;
+
+  // SPI transfers and TWI bytes can be closer together than the longer delays; stop at each to
+  // let its interrupt in (the time it takes comes on top of the delay, as on the MCU)
+  for (;;) {
+    uint64_t next = UINT64_MAX;
+    if (spiNext < spiLength) next = spiNextAt;
+    if (!twiInt && twiNext < twiLength && twiNextAt < next) next = twiNextAt;
+    if (twiMasterPending && twiMasterAt < next) next = twiMasterAt;
+    if (next >= hal.cycles + cycles)
+      break;
+
+    uint64_t step = next > hal.cycles ? next - hal.cycles : 0;
+    hal.cycles += step;
+    cycles -= step;
+    update();
+  }
+  hal.cycles += cycles;
+
+  update();
+}
+
+void halSleep(void) {
+  sleeping = 1;
+  update();
+
+  // Advance to the next wake up source: the arrival of an input byte, the transmit data register
+  // becoming empty or a Timer0 compare match
+  if (!rxCount) {
+    uint8_t txWaiting = (regs[HAL_UCSR0B] & (1 << UDRIE0)) && !(regs[HAL_UCSR0A] & (1 << UDRE0));
+    uint64_t txReady = txWaiting ? txBusyUntil - byteCycles(txBaud) : 0;
+
+    uint8_t twiWaiting = !twiInt && twiNext < twiLength;
+    uint64_t timerMatch = TIMER0_COMPA_vect && (regs[HAL_TIMSK0] & (1 << OCIE0A)) ?
+                          timer0MatchAt() : UINT64_MAX;
+
+    if (rxNext < rxLength || spiNext < spiLength || twiWaiting || twiMasterPending) {
+      uint64_t wake = UINT64_MAX;
+      if (rxNext < rxLength) wake = rxBaud ? rxArrival[rxNext] : hal.cycles;
+      if (spiNext < spiLength && spiNextAt < wake) wake = spiNextAt;
+      if (twiWaiting && twiNextAt < wake) wake = twiNextAt;
+      if (twiMasterPending && twiMasterAt < wake) wake = twiMasterAt;
+      if (txWaiting && txReady < wake) wake = txReady;
+      if (timerMatch < wake) wake = timerMatch;
+      if (wake > hal.cycles) hal.cycles = wake;
+    } else if (txWaiting || timerMatch != UINT64_MAX) {
+      hal.cycles = txWaiting && txReady < timerMatch ? txReady : timerMatch;
+    } else {
+      inputIdle();
+    }
+  }
+
+  hal.cycles += HAL_ACCESS_CYCLES;
+  update();
+  sleeping = 0;
+}
+
+uint8_t halEepromReady(void) {
+  hal.cycles += HAL_ACCESS_CYCLES;
+  update();
+  return hal.cycles >= eepromBusyUntil;
+}
+
+uint8_t halEepromRead(uint16_t addr) {
+  while (!halEepromReady())
+    ;
+  return halEeprom[addr % HAL_EEPROM_SIZE];
+}
+
+void halEepromWrite(uint16_t addr, uint8_t value, uint8_t update) {
+  if (halEepromRead(addr) == value && update)
+    return;
+
+  halEeprom[addr % HAL_EEPROM_SIZE] = value;
+  eepromBusyUntil = hal.cycles + (uint64_t) HAL_EEPROM_WRITE_US * (F_CPU / 1000000);
+  hal.eepromWrites++;
+}
+
+typedef struct {
+  int (*put)(char, FILE*);
+  int (*get)(FILE*);
+  FILE* stream;
+} halStreamCookie;
+
+static ssize_t streamWrite(void* cookie, const char* buf, size_t n) {
+  halStreamCookie* c = cookie;
+
+  for (size_t i = 0; i < n; i++) {
+    if (c->put(buf[i], c->stream) != 0)
+      return i ? (ssize_t) i : -1;
+  }
+  return n;
+}
+
+static ssize_t streamRead(void* cookie, char* buf, size_t n) {
+  halStreamCookie* c = cookie;
+  int data = c->get(c->stream);
+
+  if (data < 0)
+    return data == _FDEV_EOF ? 0 : -1;
+  buf[0] = data;
+  return 1;
+}
+
+FILE* halStream(int (*put)(char, FILE*), int (*get)(FILE*), uint8_t rwflag) {
+  cookie_io_functions_t io = {
+    .read = (rwflag & _FDEV_SETUP_READ) ? streamRead : NULL,
+    .write = (rwflag & _FDEV_SETUP_WRITE) ? streamWrite : NULL,
+  };
+  halStreamCookie* c = malloc(sizeof(halStreamCookie));
+  c->put = put;
+  c->get = get;
+  c->stream = fopencookie(c, rwflag == _FDEV_SETUP_RW ? "r+" :
+                             rwflag == _FDEV_SETUP_WRITE ? "w" : "r", io);
+  setvbuf(c->stream, NULL, _IONBF, 0);
+  return c->stream;
+}
+
+//---------------------------------------------------------------------------------------------
+// Harness functions
+
+void halReset(void) {
+  memset((void*) regs, 0, sizeof(regs));
+  memset(&hal, 0, sizeof(hal));
+  hd44780Init(&hal.lcd);
+
+  regs[HAL_UCSR0A] = (1 << UDRE0);
+  inInterrupt = 0;
+  sleeping = 0;
+  lcdWasDriving = 0;
+
+  rxLength = rxNext = 0;
+  rxCount = 0;
+  rxIdlePolls = 0;
+  txBusyUntil = 0;
+  timer0Synced = timer1Synced = 0;
+  eepromBusyUntil = 0;
+  spiLength = spiNext = 0;
+  spiBackoff = spiReceived = spiOut = 0;
+  spiMasterAt = 0;
+  spiShift = latchWas = 0;
+  twiLength = twiNext = 0;
+  twiInt = twiAck = twiAddressed = 0;
+  twiRetry = 0;
+  twiMaster = twiMasterPending = 0;
+  twiMasterStatus = 0;
+  twiStopAt = 0;
+
+  // Binding reads the register addresses through halReg; do so with no pins connected
+  halPin unconnected = { -1, -1, -1, 0 };
+  lcdPins.rs = lcdPins.rw = lcdPins.e = lcdPins.latch = unconnected;
+  for (uint8_t i = 0; i < 8; i++) lcdPins.data[i] = unconnected;
+
+  halLCDPins pins = lcdPins;
+  halLCDBindPins(&pins);
+  lcdPins = pins;
+
+  hal.cycles = hal.accesses = 0;
+}
+
+int halRun(void (*entry)(void)) {
+  if (setjmp(haltJmp)) {
+    running = 0;
+    inInterrupt = 0;
+    sleeping = 0;
+    return 1;
+  }
+
+  running = 1;
+  entry();
+  running = 0;
+  return 0;
+}
+
+void halUsartInput(const uint8_t* data, size_t n) {
+  if (rxLength + n > rxCapacity) {
+    rxCapacity = (rxLength + n) * 2;
+    rxInput = realloc(rxInput, rxCapacity);
+    rxArrival = realloc(rxArrival, rxCapacity * sizeof(*rxArrival));
+    if (!rxInput || !rxArrival) abort();
+  }
+
+  uint64_t arrival = rxLength ? rxArrival[rxLength - 1] : 0;
+  if (arrival < hal.cycles) arrival = hal.cycles;
+
+  for (size_t i = 0; i < n; i++) {
+    if (rxBaud) arrival += byteCycles(rxBaud);
+    rxInput[rxLength] = data[i];
+    rxArrival[rxLength++] = arrival;
+  }
+}
+
+void halSpiInput(const uint8_t* data, size_t n) {
+  if (spiLength + n > spiCapacity) {
+    spiCapacity = (spiLength + n) * 2;
+    spiInput = realloc(spiInput, spiCapacity);
+    if (!spiInput) abort();
+  }
+
+  if (spiNext == spiLength && spiNextAt < hal.cycles + spiPeriod)
+    spiNextAt = hal.cycles + spiPeriod;
+
+  memcpy(spiInput + spiLength, data, n);
+  spiLength += n;
+}
+
+void halSpiPacing(uint32_t rate, uint8_t limit, uint32_t holdUs) {
+  spiPeriod = rate ? F_CPU / rate : 0;
+  spiLimit = limit;
+  spiHold = (uint64_t) holdUs * (F_CPU / 1000000);
+}
+
+size_t halSpiPending(void) {
+  return spiLength - spiNext;
+}
+
+void halSetSpiHandler(void (*handler)(uint8_t)) {
+  spiHandler = handler;
+}
+
+static void twiQueue(uint8_t type, uint8_t data) {
+  if (twiLength == twiCapacity) {
+    twiCapacity = twiCapacity ? twiCapacity * 2 : 256;
+    twiItems = realloc(twiItems, twiCapacity * sizeof(*twiItems));
+    if (!twiItems) abort();
+  }
+
+  if (twiNext == twiLength && !twiInt && twiNextAt < hal.cycles)
+    twiNextAt = hal.cycles;
+  if (twiNext == twiLength && !twiInt)
+    twiNextAt += twiBitCycles * (type == TWI_START ? 10 : type == TWI_STOP ? 2 : 9);
+
+  twiItems[twiLength].type = type;
+  twiItems[twiLength++].data = data;
+}
+
+void halTwiWrite(uint8_t address, uint8_t reg, const uint8_t* data, size_t n) {
+  twiQueue(TWI_START, address << 1);
+  twiQueue(TWI_WRITE, reg);
+  for (size_t i = 0; i < n; i++)
+    twiQueue(TWI_WRITE, data[i]);
+  twiQueue(TWI_STOP, 0);
+}
+
+void halTwiRead(uint8_t address, uint8_t reg, size_t n) {
+  twiQueue(TWI_START, address << 1);
+  twiQueue(TWI_WRITE, reg);
+  twiQueue(TWI_START, address << 1 | 1);
+  for (size_t i = 0; i < n; i++)
+    twiQueue(TWI_READ, i + 1 == n);
+  twiQueue(TWI_STOP, 0);
+}
+
+void halTwiPacing(uint32_t bitRate) {
+  twiBitCycles = F_CPU / bitRate;
+}
+
+size_t halTwiPending(void) {
+  return twiLength - twiNext;
+}
+
+void halSetTwiHandler(void (*handler)(uint8_t)) {
+  twiHandler = handler;
+}
+
+void halUsartPacing(uint32_t baud) {
+  rxBaud = baud;
+}
+
+void halUsartTransmitPacing(uint32_t baud) {
+  txBaud = baud;
+}
+
+size_t halUsartPending(void) {
+  return rxLength - rxNext + rxCount;
+}
+
+void halSetTransmitHandler(void (*handler)(uint8_t)) {
+  transmitHandler = handler;
+}
+
+void halSetIdleHandler(uint8_t (*handler)(void)) {
+  idleHandler = handler;
+}
+
+uint64_t halNanoseconds(void) {
+  // In two parts so that the product can't overflow (it would after about 38 minutes)
+  return hal.cycles / F_CPU * 1000000000ULL + hal.cycles % F_CPU * 1000000000ULL / F_CPU;
+}
+
+void halRenderLCD(char* out) {
+  hd44780Render(&hal.lcd, halLCDRows, halLCDColumns, halLCDLineBeginnings, out);
+}
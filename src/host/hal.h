@@ -0,0 +1,312 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file hal.h
+ * @brief Host side hardware abstraction layer used to run the firmware off-target.
+ *
+ * The headers in host/avr and host/util stand in for avr-libc. Every IO register access made
+ * by the firmware goes through halReg, which advances a simulated clock, propagates the
+ * previous register writes to the device models (the HD44780 model on the LCD pins and a
+ * USART model) and dispatches any pending interrupts. Busy waits (_delay_us/_delay_ms) advance
+ * the clock by their duration. Time is accounted in CPU cycles at F_CPU.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "hd44780.h"
+
+/* Estimated CPU cycles per IO register access (load/store plus surrounding bit twiddling) */
+#define HAL_ACCESS_CYCLES 2
+
+/* Number of consecutive empty polls of the USART receiver before the input is considered idle */
+#define HAL_IDLE_POLLS    64
+
+/**
+   EEPROM size (ATmega328P) and the time taken by each byte written to it.
+ */
+#define HAL_EEPROM_SIZE      1024
+#define HAL_EEPROM_WRITE_US  3400
+
+typedef enum {
+  HAL_PORTB, HAL_DDRB, HAL_PINB,
+  HAL_PORTC, HAL_DDRC, HAL_PINC,
+  HAL_PORTD, HAL_DDRD, HAL_PIND,
+  HAL_SREG,
+  HAL_UDR0, HAL_UCSR0A, HAL_UCSR0B, HAL_UCSR0C, HAL_UBRR0H, HAL_UBRR0L,
+  HAL_TCCR1A, HAL_TCCR1B, HAL_TCNT1L, HAL_TCNT1H, HAL_TIMSK1, HAL_TIFR1,
+  HAL_TCCR0A, HAL_TCCR0B, HAL_TCNT0, HAL_OCR0A, HAL_TIMSK0, HAL_TIFR0,
+  HAL_SPCR, HAL_SPSR, HAL_SPDR,
+  HAL_TWBR, HAL_TWSR, HAL_TWAR, HAL_TWDR, HAL_TWCR,
+  HAL_MCUSR, HAL_WDTCSR,
+  HAL_EXPANDER,         ///< Outputs of the port expander or shift register driving the LCD
+  HAL_REGISTER_COUNT
+} halRegister;
+
+/**
+   Connection of one LCD interface line to a MCU pin (port < 0 when unconnected).
+ */
+typedef struct {
+  int8_t port;
+  int8_t ddr;
+  int8_t pin;
+  uint8_t bit;
+} halPin;
+
+typedef struct {
+  halPin rs, rw, e;
+  halPin data[8];       ///< D0..D7
+  halPin latch;         ///< Latches the shift register onto HAL_EXPANDER (HC595_MODE)
+} halLCDPins;
+
+/**
+   Simulation state and statistics.
+ */
+typedef struct {
+  uint64_t cycles;           ///< Simulated CPU cycles since reset
+  uint64_t accesses;         ///< IO register accesses
+  uint64_t delayCycles;      ///< Cycles spent in _delay_us/_delay_ms
+  uint64_t busContention;    ///< Enable pulses where the LCD drove a line the MCU also drove
+
+  hd44780 lcd;
+
+  uint64_t rxBytes;          ///< Bytes read from the USART
+  uint64_t rxOverruns;       ///< Bytes lost because the USART receive buffer was full
+  uint64_t txBytes;          ///< Bytes written to the USART
+  uint64_t rxLastRead;       ///< Cycle of the last receive data register read
+  uint64_t rxMaxGap;         ///< Longest time (cycles) between two receive data register reads
+  uint64_t rxMaxGapAt;       ///< Index in the input stream of the byte that ended the longest gap
+
+  uint64_t spiBytes;         ///< Bytes sent by the simulated SPI master
+  uint64_t spiOverruns;      ///< Of which lost because SPDR still held the previous byte
+  uint64_t spiMasterBytes;   ///< Bytes shifted out by the firmware as SPI master
+
+  uint64_t twiBytes;         ///< Data bytes written by the simulated TWI master (with resends)
+  uint64_t twiNacks;         ///< Addresses and data bytes not acknowledged by the firmware
+  uint64_t twiStretch;       ///< Cycles SCL was held low waiting for the firmware
+  uint64_t twiMasterBytes;   ///< Bytes sent by the firmware as TWI master (addresses included)
+  uint64_t twiTransactions;  ///< Of which transactions (START conditions)
+
+  uint64_t eepromWrites;     ///< Bytes written to the EEPROM
+} halState;
+
+/**
+   EEPROM contents; erased (0xff) initially and kept across halReset, as through a brown-out.
+ */
+extern uint8_t halEeprom[HAL_EEPROM_SIZE];
+
+extern halState hal;
+
+//---------------------------------------------------------------------------------------------
+// Firmware facing functions (used by the avr-libc stand in headers)
+
+/**
+   Returns the IO register reg after advancing time and updating the device models.
+ */
+volatile uint8_t* halReg(halRegister reg);
+
+/**
+   Reads the receive data register (popping a byte from the USART receive buffer).
+ */
+uint8_t halUsartReceive(void);
+
+/**
+   Writes the transmit data register.
+ */
+void halUsartTransmit(uint8_t data);
+
+/**
+   Reads the SPI data register (the last byte received).
+ */
+uint8_t halSpiReceive(void);
+
+/**
+   Writes the SPI data register (the byte shifted out during the next transfer).
+ */
+void halSpiTransmit(uint8_t data);
+
+/**
+   Returns non-zero while TWINT is set (the TWI waits for the firmware).
+ */
+uint8_t halTwiInterrupt(void);
+
+/**
+   Busy wait for the given number of microseconds.
+ */
+void halDelayUs(double us);
+
+/**
+   Sleep (idle mode) until the next interrupt source becomes pending.
+ */
+void halSleep(void);
+
+/**
+   Returns non-zero if the EEPROM is not busy writing.
+ */
+uint8_t halEepromReady(void);
+
+/**
+   Returns the EEPROM byte at addr (waiting for a write in progress to finish first).
+ */
+uint8_t halEepromRead(uint16_t addr);
+
+/**
+   Waits for a write in progress to finish, then starts writing value to the EEPROM byte at addr
+   (unless it already holds value and update is non-zero).
+ */
+void halEepromWrite(uint16_t addr, uint8_t value, uint8_t update);
+
+/**
+   Returns an unbuffered stream calling put for each byte written and get for each byte read
+   (either may be null per rwflag, one of _FDEV_SETUP_READ/WRITE/RW), for fdev_setup_stream.
+ */
+FILE* halStream(int (*put)(char, FILE*), int (*get)(FILE*), uint8_t rwflag);
+
+//---------------------------------------------------------------------------------------------
+// Harness functions
+
+/**
+   Power on reset: clears all registers, statistics and the LCD model.
+ */
+void halReset(void);
+
+/**
+   Runs entry until it returns or the firmware waits for input that will never come (see
+   halSetIdleHandler). Returns non-zero if the run was stopped while waiting for input.
+ */
+int halRun(void (*entry)(void));
+
+/**
+   Queue bytes to be received by the USART. With pacing enabled bytes arrive at the configured
+   baud rate (and are lost if not read in time); otherwise each byte is available as soon as the
+   previous one has been read.
+ */
+void halUsartInput(const uint8_t* data, size_t n);
+
+/**
+   Sets the rate at which queued input bytes arrive (10 bits per byte); 0 disables pacing.
+ */
+void halUsartPacing(uint32_t baud);
+
+/**
+   Sets the rate at which transmitted bytes leave the USART (BAUD by default); 0 makes
+   transmission instantaneous.
+ */
+void halUsartTransmitPacing(uint32_t baud);
+
+/**
+   Number of queued input bytes that have not yet been read by the firmware.
+ */
+size_t halUsartPending(void);
+
+/**
+   Queue bytes for the simulated SPI master to send to the firmware (see halSpiPacing).
+ */
+void halSpiInput(const uint8_t* data, size_t n);
+
+/**
+   The SPI master sends rate bytes per second; after receiving a status byte (the byte the
+   firmware last wrote to SPDR) above limit it waits a further holdUs before sending the next
+   byte, doubling the wait each time in a row up to 1024 times holdUs.
+ */
+void halSpiPacing(uint32_t rate, uint8_t limit, uint32_t holdUs);
+
+/**
+   Number of queued SPI bytes not yet sent.
+ */
+size_t halSpiPending(void);
+
+/**
+   Called with every byte the SPI master receives (on MISO).
+ */
+void halSetSpiHandler(void (*handler)(uint8_t));
+
+/**
+   Queue a write transaction for the simulated TWI master: the register number reg, then n bytes
+   of data. Refused data bytes are sent again (see halTwiPacing).
+ */
+void halTwiWrite(uint8_t address, uint8_t reg, const uint8_t* data, size_t n);
+
+/**
+   Queue a read of n bytes from register reg (a write of reg, then a repeated start); the bytes
+   go to the TWI handler.
+ */
+void halTwiRead(uint8_t address, uint8_t reg, size_t n);
+
+/**
+   Sets the SCL frequency of the TWI master (100kHz by default). Each byte takes nine bit times,
+   plus the time the firmware holds the clock; after a refused byte the master pauses for 100 bit
+   times, then resends the register number and the rest of the transaction from that byte.
+ */
+void halTwiPacing(uint32_t bitRate);
+
+/**
+   Number of queued TWI bus operations not yet carried out.
+ */
+size_t halTwiPending(void);
+
+/**
+   Called with every byte the TWI master reads.
+ */
+void halSetTwiHandler(void (*handler)(uint8_t));
+
+/**
+   Called with every byte transmitted by the firmware.
+ */
+void halSetTransmitHandler(void (*handler)(uint8_t));
+
+/**
+   Called when the firmware waits for input and none is queued. The handler may queue more input
+   and return non-zero to continue; returning zero stops the run.
+ */
+void halSetIdleHandler(uint8_t (*handler)(void));
+
+/**
+   Simulated time since reset in nanoseconds.
+ */
+uint64_t halNanoseconds(void);
+
+/**
+   Number of lines, characters per line and line beginnings of the LCD (from lcdLibConfig.h).
+ */
+extern const uint8_t halLCDRows;
+extern const uint8_t halLCDColumns;
+extern const uint8_t halLCDLineBeginnings[];
+
+/**
+   TWI address of the PCF8574 expander driving the LCD (its outputs are HAL_EXPANDER), or 0 if
+   the LCD is on the IO pins.
+ */
+extern const uint8_t halLCDExpanderAddress;
+
+/**
+   Fills pins with the LCD interface connections described by lcdLibConfig.h.
+ */
+void halLCDBindPins(halLCDPins* pins);
+
+/**
+   Renders the LCD contents (see hd44780Render); out must hold halLCDRows * (halLCDColumns + 1)
+   characters.
+ */
+void halRenderLCD(char* out);
+
+#endif /* HAL_H */
@@ -0,0 +1,95 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: halLCD.c
+ *
+ * Connects the HD44780 model to the pins configured in lcdLibConfig.h. Compiled with the same
+ * configuration (mode and geometry) as lcdLib.c.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include "hal.h"
+#include "lcdLib.h"
+
+// Index of an IO register given the register expression from lcdLibConfig.h
+#define REG_INDEX(reg) ((int8_t) (&(reg) - halReg(HAL_PORTB)))
+
+#define PIN(port, ddr, pin, bit) ((halPin) { REG_INDEX(port), REG_INDEX(ddr), REG_INDEX(pin), (bit) })
+
+const uint8_t halLCDRows = LCD_NUMBER_OF_LINES;
+const uint8_t halLCDColumns = LCD_CHARACTERS_PER_LINE;
+const uint8_t halLCDLineBeginnings[] = { LCD_LINE_BEGINNINGS };
+
+#ifdef PCF8574_MODE
+const uint8_t halLCDExpanderAddress = LCD_PCF8574_ADDRESS;
+
+// The expander has no direction register; its outputs never read the LCD (RW stays low)
+#define EXPANDER_PIN(bit) ((halPin) { HAL_EXPANDER, HAL_EXPANDER, HAL_EXPANDER, (bit) })
+
+void halLCDBindPins(halLCDPins* pins) {
+  pins->rs = EXPANDER_PIN(LCD_RS);
+  pins->rw = EXPANDER_PIN(LCD_RW);
+  pins->e  = EXPANDER_PIN(LCD_ENABLE);
+  pins->data[4] = EXPANDER_PIN(LCD_DBUS4);
+  pins->data[5] = EXPANDER_PIN(LCD_DBUS5);
+  pins->data[6] = EXPANDER_PIN(LCD_DBUS6);
+  pins->data[7] = EXPANDER_PIN(LCD_DBUS7);
+}
+#elif defined (HC595_MODE)
+const uint8_t halLCDExpanderAddress = 0;
+
+// The shift register outputs have no direction register; they never read the LCD (RW stays low)
+#define EXPANDER_PIN(bit) ((halPin) { HAL_EXPANDER, HAL_EXPANDER, HAL_EXPANDER, (bit) })
+
+void halLCDBindPins(halLCDPins* pins) {
+  pins->rs = EXPANDER_PIN(LCD_RS);
+  pins->rw = EXPANDER_PIN(LCD_RW);
+  pins->e  = PIN(LCD_ENABLE_PORT, LCD_ENABLE_DDR, LCD_ENABLE_PORT, LCD_ENABLE);
+  pins->data[4] = EXPANDER_PIN(LCD_DBUS4);
+  pins->data[5] = EXPANDER_PIN(LCD_DBUS5);
+  pins->data[6] = EXPANDER_PIN(LCD_DBUS6);
+  pins->data[7] = EXPANDER_PIN(LCD_DBUS7);
+  pins->latch = PIN(LCD_HC595_LATCH_PORT, LCD_HC595_LATCH_DDR, LCD_HC595_LATCH_PORT,
+                    LCD_HC595_LATCH);
+}
+#else
+const uint8_t halLCDExpanderAddress = 0;
+
+void halLCDBindPins(halLCDPins* pins) {
+  // Control lines are outputs only; PIN is unused
+  pins->rs = PIN(LCD_RS_PORT, LCD_RS_DDR, LCD_RS_PORT, LCD_RS);
+  pins->rw = PIN(LCD_RW_PORT, LCD_RW_DDR, LCD_RW_PORT, LCD_RW);
+  pins->e  = PIN(LCD_ENABLE_PORT, LCD_ENABLE_DDR, LCD_ENABLE_PORT, LCD_ENABLE);
+
+#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
+#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
+  pins->data[0] = PIN(LCD_DBUS0_PORT, LCD_DBUS0_DDR, LCD_DBUS0_PIN, LCD_DBUS0);
+  pins->data[1] = PIN(LCD_DBUS1_PORT, LCD_DBUS1_DDR, LCD_DBUS1_PIN, LCD_DBUS1);
+  pins->data[2] = PIN(LCD_DBUS2_PORT, LCD_DBUS2_DDR, LCD_DBUS2_PIN, LCD_DBUS2);
+  pins->data[3] = PIN(LCD_DBUS3_PORT, LCD_DBUS3_DDR, LCD_DBUS3_PIN, LCD_DBUS3);
+#endif
+  pins->data[4] = PIN(LCD_DBUS4_PORT, LCD_DBUS4_DDR, LCD_DBUS4_PIN, LCD_DBUS4);
+  pins->data[5] = PIN(LCD_DBUS5_PORT, LCD_DBUS5_DDR, LCD_DBUS5_PIN, LCD_DBUS5);
+  pins->data[6] = PIN(LCD_DBUS6_PORT, LCD_DBUS6_DDR, LCD_DBUS6_PIN, LCD_DBUS6);
+  pins->data[7] = PIN(LCD_DBUS7_PORT, LCD_DBUS7_DDR, LCD_DBUS7_PIN, LCD_DBUS7);
+#else
+  for (uint8_t i = 0; i < 8; i++)
+    pins->data[i] = PIN(LCD_DBUS_PORT, LCD_DBUS_DDR, LCD_DBUS_PIN, i);
+#endif
+}
+#endif
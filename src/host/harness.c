@@ -0,0 +1,81 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: harness.c
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include "hal.h"
+#include "harness.h"
+
+// The firmware itself; its main becomes uartEchoMain
+#define main uartEchoMain
+#include "uart_echo.c"
+#undef main
+
+//---------------------------------------------------------------------------------------------
+// Static global variables
+
+static uint8_t (*idleHandler)(uint16_t);
+static uint16_t idleCalls;
+
+static const uint8_t* input;
+static size_t inputLength;
+
+//---------------------------------------------------------------------------------------------
+// Static functions
+
+static uint8_t onIdle(void) {
+  return idleHandler(idleCalls++);
+}
+
+static void runFirmware(void) {
+  uartEchoMain();
+}
+
+static uint8_t queueInput(uint16_t call) {
+  if (call == 0) {
+    halUsartInput(input, inputLength);
+    return 1;
+  }
+  return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+// Harness functions
+
+int harnessRun(uint8_t (*handler)(uint16_t call)) {
+  idleHandler = handler;
+  idleCalls = 0;
+  halSetIdleHandler(onIdle);
+  return halRun(runFirmware);
+}
+
+int harnessRunInput(const uint8_t* data, size_t n) {
+  input = data;
+  inputLength = n;
+  return harnessRun(queueInput);
+}
+
+uint16_t harnessEchoDrops(void) {
+#if !defined (SPI_INPUT_ENABLE) && !defined (TWI_INPUT_ENABLE)
+  return echoDrops;
+#else
+  return 0;
+#endif
+}
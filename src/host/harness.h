@@ -0,0 +1,53 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file harness.h
+ * @brief Runs the uart_echo firmware on the host HAL for the benchmark and analysis tools.
+ *
+ * harness.c builds uart_echo.c itself (its main renamed), so tools link it in place of the
+ * firmware's main.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+   Runs the firmware from the current HAL state (eg. after halReset) until handler returns zero.
+   The handler is called each time the firmware waits for input with none queued (the first time
+   once the firmware has initialized) along with the number of earlier calls in this run; it may
+   queue more input and return non-zero to carry on. Returns non-zero if the run was stopped while
+   waiting for input (see halRun).
+ */
+int harnessRun(uint8_t (*handler)(uint16_t call));
+
+/**
+   Runs the firmware as harnessRun does, queueing the n bytes of data to the USART once it has
+   initialized and stopping once it has consumed them.
+ */
+int harnessRunInput(const uint8_t* data, size_t n);
+
+/**
+   Returns the number of echoes the firmware has dropped so far so as not to lose input (none when
+   input isn't over the USART, as it is then not echoed).
+ */
+uint16_t harnessEchoDrops(void);
+
+#endif /* HARNESS_H */
@@ -0,0 +1,251 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: hd44780.c
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <string.h>
+
+#include "hd44780.h"
+
+//---------------------------------------------------------------------------------------------
+// Static functions
+
+static uint8_t isBusy(const hd44780* lcd, uint64_t now) {
+  return lcd->stuckBusy || now < lcd->busyUntil;
+}
+
+static void setBusy(hd44780* lcd, uint64_t now, uint64_t ns) {
+  lcd->busyUntil = now + ns;
+  lcd->stats.busyNs += ns;
+}
+
+/*
+  Move the address counter one position in the direction given by the entry mode, following the
+  DDRAM address layout (two 40 character lines at 0x00 and 0x40, or a single 80 character line).
+ */
+static void advanceAddress(hd44780* lcd) {
+  if (lcd->cgMode) {
+    lcd->ac = (lcd->ac + (lcd->increment ? 1 : -1)) & (HD44780_CGRAM_SIZE - 1);
+  } else if (lcd->twoLine) {
+    if (lcd->increment) {
+      lcd->ac = lcd->ac == 0x27 ? 0x40 : lcd->ac == 0x67 ? 0x00 : lcd->ac + 1;
+    } else {
+      lcd->ac = lcd->ac == 0x00 ? 0x67 : lcd->ac == 0x40 ? 0x27 : lcd->ac - 1;
+    }
+  } else {
+    if (lcd->increment) {
+      lcd->ac = lcd->ac == 0x4f ? 0x00 : lcd->ac + 1;
+    } else {
+      lcd->ac = lcd->ac == 0x00 ? 0x4f : lcd->ac - 1;
+    }
+  }
+}
+
+static void executeInstruction(hd44780* lcd, uint64_t now, uint8_t b) {
+  lcd->stats.instructions++;
+
+  if (b & 0x80) {          // Set DDRAM address
+    lcd->ac = b & 0x7f;
+    lcd->cgMode = 0;
+    lcd->stats.addressSets++;
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x40) {   // Set CGRAM address
+    lcd->ac = b & 0x3f;
+    lcd->cgMode = 1;
+    lcd->stats.addressSets++;
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x20) {   // Function set
+    lcd->eightBit = (b >> 4) & 1;
+    lcd->twoLine  = (b >> 3) & 1;
+    lcd->font5x10 = (b >> 2) & 1;
+    lcd->nibbleHigh = 0;
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x10) {   // Cursor or display shift
+    if (b & 0x08) {
+      lcd->displayShift += (b & 0x04) ? 1 : -1;
+    } else {
+      uint8_t increment = lcd->increment;
+      lcd->increment = (b & 0x04) ? 1 : 0;
+      advanceAddress(lcd);
+      lcd->increment = increment;
+    }
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x08) {   // Display control
+    lcd->displayOn = (b >> 2) & 1;
+    lcd->cursorOn  = (b >> 1) & 1;
+    lcd->blinkOn   = b & 1;
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x04) {   // Entry mode set
+    lcd->increment    = (b >> 1) & 1;
+    lcd->shiftOnWrite = b & 1;
+    setBusy(lcd, now, HD44780_EXEC_INSTR_NS);
+  } else if (b & 0x02) {   // Return home
+    lcd->ac = 0;
+    lcd->cgMode = 0;
+    lcd->displayShift = 0;
+    lcd->stats.clears++;
+    setBusy(lcd, now, HD44780_EXEC_HOME_NS);
+  } else if (b & 0x01) {   // Clear display
+    memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+    lcd->ac = 0;
+    lcd->cgMode = 0;
+    lcd->increment = 1;
+    lcd->displayShift = 0;
+    lcd->stats.clears++;
+    setBusy(lcd, now, HD44780_EXEC_CLEAR_NS);
+  }
+}
+
+static void writeData(hd44780* lcd, uint64_t now, uint8_t b) {
+  lcd->stats.dataWrites++;
+
+  if (lcd->cgMode) {
+    lcd->cgram[lcd->ac & (HD44780_CGRAM_SIZE - 1)] = b;
+  } else {
+    lcd->ddram[lcd->ac & (HD44780_DDRAM_SIZE - 1)] = b;
+    if (lcd->shiftOnWrite)
+      lcd->displayShift += lcd->increment ? -1 : 1;
+  }
+
+  advanceAddress(lcd);
+  setBusy(lcd, now, HD44780_EXEC_DATA_NS);
+}
+
+/*
+  The byte presented on the data lines for a read transfer with the current RS level.
+ */
+static uint8_t readValue(const hd44780* lcd, uint64_t now) {
+  if (lcd->rs) {
+    return lcd->cgMode ? lcd->cgram[lcd->ac & (HD44780_CGRAM_SIZE - 1)] : lcd->ddram[lcd->ac & (HD44780_DDRAM_SIZE - 1)];
+  } else {
+    return (isBusy(lcd, now) ? 0x80 : 0) | (lcd->ac & 0x7f);
+  }
+}
+
+static void completeWrite(hd44780* lcd, uint64_t now, uint8_t b) {
+  if (isBusy(lcd, now)) {
+    lcd->stats.busyViolations++; // The controller ignores transfers while busy
+    return;
+  }
+
+  if (lcd->rs) {
+    writeData(lcd, now, b);
+  } else {
+    executeInstruction(lcd, now, b);
+  }
+}
+
+static void completeRead(hd44780* lcd, uint64_t now) {
+  if (!lcd->rs) {
+    lcd->stats.statusReads++;
+  } else if (isBusy(lcd, now)) {
+    lcd->stats.busyViolations++;
+  } else {
+    lcd->stats.dataReads++;
+    advanceAddress(lcd);
+    setBusy(lcd, now, HD44780_EXEC_DATA_NS);
+  }
+}
+
+//---------------------------------------------------------------------------------------------
+// Model functions
+
+void hd44780Init(hd44780* lcd) {
+  memset(lcd, 0, sizeof(*lcd));
+  memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+
+  // Power on reset state: 8-bit interface, one line, display off, increment mode
+  lcd->eightBit = 1;
+  lcd->increment = 1;
+}
+
+void hd44780Pins(hd44780* lcd, uint64_t now, uint8_t rs, uint8_t rw, uint8_t e, uint8_t data) {
+  uint8_t rising  = !lcd->e && e;
+  uint8_t falling = lcd->e && !e;
+
+  lcd->rs = rs;
+  lcd->rw = rw;
+  lcd->e  = e;
+  lcd->data = data;
+
+  if (rising && rw) {
+    // Present data on the bus for the duration of the enable pulse
+    if (lcd->eightBit) {
+      lcd->readByte = readValue(lcd, now);
+      lcd->output = lcd->readByte;
+    } else if (!lcd->nibbleHigh) {
+      lcd->readByte = readValue(lcd, now);
+      lcd->output = lcd->readByte & 0xf0;
+    } else {
+      lcd->output = (uint8_t) (lcd->readByte << 4);
+    }
+    lcd->driving = 1;
+  } else if (falling) {
+    lcd->stats.eCycles++;
+    lcd->driving = 0;
+
+    if (lcd->eightBit) {
+      if (rw) {
+        completeRead(lcd, now);
+      } else {
+        completeWrite(lcd, now, data);
+      }
+    } else if (!lcd->nibbleHigh) {
+      lcd->latched = data & 0xf0;
+      lcd->nibbleHigh = 1;
+    } else {
+      lcd->nibbleHigh = 0;
+      if (rw) {
+        completeRead(lcd, now);
+      } else {
+        completeWrite(lcd, now, lcd->latched | (data >> 4));
+      }
+    }
+  }
+}
+
+uint8_t hd44780Output(const hd44780* lcd, uint8_t* data) {
+  if (lcd->driving && lcd->e && lcd->rw) {
+    *data = lcd->output;
+    return 1;
+  }
+  return 0;
+}
+
+void hd44780Render(const hd44780* lcd, uint8_t rows, uint8_t cols, const uint8_t* lineBeginnings, char* out) {
+  for (uint8_t row = 0; row < rows; row++) {
+    for (uint8_t col = 0; col < cols; col++) {
+      uint8_t addr;
+
+      if (lcd->twoLine) {
+        // Each line holds 40 characters; the display shift rotates within the line
+        int offset = ((lineBeginnings[row] & 0x3f) + col - lcd->displayShift) % 40;
+        addr = (lineBeginnings[row] & 0x40) | (offset < 0 ? offset + 40 : offset);
+      } else {
+        int offset = (lineBeginnings[row] + col - lcd->displayShift) % 80;
+        addr = offset < 0 ? offset + 80 : offset;
+      }
+
+      uint8_t c = lcd->ddram[addr];
+      *(out++) = (c >= 0x20 && c < 0x7f) ? c : '?';
+    }
+    *(out++) = '\0';
+  }
+}
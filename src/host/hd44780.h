@@ -0,0 +1,114 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file hd44780.h
+ * @brief Behavioural model of a HD44780 compatible character LCD controller (host only).
+ *
+ * The model is driven at the pin level: every change of RS, RW, E or the data lines is passed
+ * to hd44780Pins along with the current simulated time. Transfers are decoded on the edges of E
+ * in both the 8-bit and 4-bit interface modes. DDRAM, CGRAM, the address counter and the busy
+ * flag are modelled with datasheet execution times, and every bus operation is accounted for in
+ * the model's statistics.
+ */
+
+#ifndef HD44780_H
+#define HD44780_H
+
+#include <stdint.h>
+
+#define HD44780_DDRAM_SIZE 0x80
+#define HD44780_CGRAM_SIZE 0x40
+
+/* Execution times (in nanoseconds) as given by the datasheet (fosc = 270kHz) */
+#define HD44780_EXEC_CLEAR_NS   1520000
+#define HD44780_EXEC_HOME_NS    1520000
+#define HD44780_EXEC_INSTR_NS   37000
+#define HD44780_EXEC_DATA_NS    41000   ///< 37us plus tADD (address counter update)
+
+/**
+   Bus operation statistics. All counts are of complete (8 bit) transfers unless noted.
+ */
+typedef struct {
+  uint64_t eCycles;          ///< Falling edges of E (nibbles in 4-bit mode)
+  uint64_t instructions;     ///< Instruction writes (RS=0, RW=0)
+  uint64_t addressSets;      ///< DDRAM/CGRAM address set instructions (subset of instructions)
+  uint64_t clears;           ///< Clear display and return home instructions
+  uint64_t dataWrites;       ///< Data writes (RS=1, RW=0)
+  uint64_t dataReads;        ///< Data reads (RS=1, RW=1)
+  uint64_t statusReads;      ///< Busy flag/address reads (RS=0, RW=1)
+  uint64_t busyViolations;   ///< Writes or data reads while the controller was busy (ignored)
+  uint64_t busyNs;           ///< Total controller execution time
+} hd44780Stats;
+
+typedef struct {
+  uint8_t ddram[HD44780_DDRAM_SIZE];
+  uint8_t cgram[HD44780_CGRAM_SIZE];
+
+  uint8_t ac;              ///< Address counter
+  uint8_t cgMode;          ///< Non-zero when the address counter refers to CGRAM
+  uint8_t increment;       ///< Entry mode I/D
+  uint8_t shiftOnWrite;    ///< Entry mode S
+  uint8_t displayOn;
+  uint8_t cursorOn;
+  uint8_t blinkOn;
+  uint8_t eightBit;        ///< Function set DL (interface is 8-bit after power on)
+  uint8_t twoLine;         ///< Function set N
+  uint8_t font5x10;        ///< Function set F
+  int8_t  displayShift;    ///< Display shift (in characters)
+
+  uint64_t busyUntil;      ///< Simulated time (ns) at which the busy flag clears
+  uint8_t  stuckBusy;      ///< Fault injection: when set, the busy flag never clears
+
+  /* Interface state */
+  uint8_t rs, rw, e;       ///< Last seen control line levels
+  uint8_t data;            ///< Last seen data lines (D7..D0) as driven by the host
+  uint8_t nibbleHigh;      ///< 4-bit mode: the high nibble of a transfer has been latched
+  uint8_t latched;         ///< 4-bit mode: latched high nibble (in bits 7..4)
+  uint8_t readByte;        ///< Byte being presented during a read transfer
+  uint8_t output;          ///< Data lines currently driven by the controller
+  uint8_t driving;         ///< Non-zero while the controller drives the data lines
+
+  hd44780Stats stats;
+} hd44780;
+
+/**
+   Reset the model to its power on state.
+ */
+void hd44780Init(hd44780* lcd);
+
+/**
+   Update the interface lines at simulated time now (ns). data holds the levels of D7..D0 as
+   driven by the host (unconnected lines read as 0).
+ */
+void hd44780Pins(hd44780* lcd, uint64_t now, uint8_t rs, uint8_t rw, uint8_t e, uint8_t data);
+
+/**
+   Returns non-zero while the controller drives the data lines (RW=1 with E high), setting
+   *data to the driven levels of D7..D0.
+ */
+uint8_t hd44780Output(const hd44780* lcd, uint8_t* data);
+
+/**
+   Render the visible characters of the display into out, one null terminated line of cols
+   characters per row (out must hold rows * (cols + 1) characters). lineBeginnings gives the
+   DDRAM address of each physical line. Non printable characters (including CGRAM characters)
+   are rendered as '?'.
+ */
+void hd44780Render(const hd44780* lcd, uint8_t rows, uint8_t cols, const uint8_t* lineBeginnings, char* out);
+
+#endif /* HD44780_H */
@@ -0,0 +1,188 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: latency.c
+ *
+ * Worst case receive latency analysis of uart_echo: drives the firmware with adversarial input
+ * (and the benchmark workloads) on the host HAL and reports the longest time the firmware goes
+ * without taking input, together with the input that preceded it.
+ *
+ * Usage: latency [-b buffer] [baud ...]
+ *
+ * Exits non-zero if any run is flagged.
+ *
+ * For each baud rate (BAUD by default) the input is offered whenever the firmware waits for it
+ * (sleeps with reception interrupt driven), while echoed bytes leave at that baud rate. A service
+ * gap of G cycles lets floor(G / T) bytes arrive (T being the time of one 10 bit frame); more than
+ * the receive buffer holds (-b, by default what the USART receive buffer holds) is flagged as an
+ * overrun. The input is then replayed at the baud rate itself to count the bytes that would
+ * actually be lost, either by the USART or its receive buffer; any loss is flagged too. Echoes
+ * the firmware dropped so as not to lose input are counted separately ("echo"), as they cost no
+ * input.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "harness.h"
+#include "lcdLib.h"
+#include "USART.h"
+#include "workloads.h"
+
+//---------------------------------------------------------------------------------------------
+
+#define REPEAT 8
+
+typedef struct {
+  const char* name;
+  const char* sequence; ///< Repeated REPEAT times after the screen has been filled (cursor home)
+} adversary;
+
+static const adversary adversaries[] = {
+  { "wrap",     "\e[4;1H0123456789abcdefghijklmnopqrstuvwxyz" },    // Wrapping off the last line
+  { "return",   "\e[4;1Hx\r" },                                     // Return on the last line
+  { "su",       "\e[1S" },
+  { "sd",       "\e[1T" },
+  { "su-all",   "\e[9S" },
+  { "il",       "\e[1;1H\e[1L" },
+  { "dl",       "\e[1;1H\e[1M" },
+  { "ich",      "\e[1;1H\e[1@" },
+  { "dch",      "\e[1;1H\e[1P" },
+  { "ed",       "\e[2J" },
+  { "el",       "\e[2K" },
+  { "margins",  "\e[2;4r\e[4;1H\rmargin\e[r" },
+  { "dsr",      "\e[6n" },
+  { "backspace", "\x7f\x7f\x7f" },
+  { 0, 0 }
+};
+
+static uint8_t input[BENCH_WORKLOAD_MAX];
+static size_t inputLength;
+/*
+  Builds the input for the given adversary: the screen filled with text (stopping short of the
+  last cell, which would scroll), the cursor sent home, then its sequence.
+ */
+static void buildAdversary(const adversary* a) {
+  inputLength = 0;
+  for (uint16_t i = 0; i < LCD_NUMBER_OF_LINES * LCD_CHARACTERS_PER_LINE - 1; i++)
+    input[inputLength++] = 'A' + i % 26;
+  memcpy(input + inputLength, "\e[H", 3);
+  inputLength += 3;
+
+  size_t n = strlen(a->sequence);
+  for (uint8_t i = 0; i < REPEAT && inputLength + n <= sizeof(input); i++) {
+    memcpy(input + inputLength, a->sequence, n);
+    inputLength += n;
+  }
+}
+
+/*
+  Prints (up to) the n input bytes preceding index at, escaping non printable characters.
+ */
+static void printContext(size_t at, size_t n) {
+  size_t from = at > n ? at - n : 0;
+  putchar('"');
+  for (size_t i = from; i < at && i < inputLength; i++) {
+    uint8_t c = input[i];
+    if (c == '\e') printf("\\e");
+    else if (c == '\r') printf("\\r");
+    else if (c == '\n') printf("\\n");
+    else if (c < 0x20 || c >= 0x7f) printf("\\x%02x", c);
+    else putchar(c);
+  }
+  putchar('"');
+}
+
+/*
+  Runs the current input at the given baud rate, returning non-zero if the longest service gap
+  would overrun a receive buffer of the given size or input was lost.
+ */
+static int analyze(const char* name, uint32_t baud, unsigned buffer) {
+  uint64_t frame = (uint64_t) F_CPU * 10 / baud;
+
+  // Worst case service gap: input always waiting, echo at the baud rate
+  halUsartPacing(0);
+  halUsartTransmitPacing(baud);
+  halReset();
+  harnessRunInput(input, inputLength);
+
+  uint64_t gap = hal.rxMaxGap;
+  uint64_t at = hal.rxMaxGapAt;
+  uint64_t arriving = gap / frame;
+
+  // Paced replay counting bytes lost (and echoes dropped, which are no loss)
+  uint16_t dropped = receiveOverruns();
+  uint16_t echoDrops = harnessEchoDrops();
+  halUsartPacing(baud);
+  halReset();
+  harnessRunInput(input, inputLength);
+  uint64_t overruns = hal.rxOverruns + (uint16_t) (receiveOverruns() - dropped);
+  echoDrops = harnessEchoDrops() - echoDrops;
+  halUsartPacing(0);
+
+  int flagged = arriving > buffer || overruns;
+  printf("%-10s %7lu %10llu %9.0f %7llu %8llu %6u  %-7s ", name, (unsigned long) baud,
+         (unsigned long long) gap, gap * 1000000.0 / F_CPU, (unsigned long long) arriving,
+         (unsigned long long) overruns, echoDrops, flagged ? "OVERRUN" : "ok");
+  printContext(at, 24);
+  putchar('\n');
+
+  return flagged;
+}
+
+int main(int argc, char** argv) {
+  unsigned buffer = USART_RX_BUFFER_SIZE - 1;
+  uint32_t bauds[16];
+  uint8_t nbauds = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      buffer = atoi(argv[++i]);
+    } else if (atol(argv[i]) > 0 && nbauds < sizeof(bauds) / sizeof(*bauds)) {
+      bauds[nbauds++] = atol(argv[i]);
+    } else {
+      fprintf(stderr, "usage: %s [-b buffer] [baud ...]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (!nbauds) bauds[nbauds++] = BAUD;
+
+  printf("uart_echo receive latency: %dx%d, F_CPU=%lu, receive buffer %u bytes\n",
+         LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) F_CPU, buffer);
+  printf("%-10s %7s %10s %9s %7s %8s %6s  %-7s %s\n", "input", "baud", "max gap", "us", "bytes",
+         "lost", "echo", "verdict", "input preceding the gap");
+
+  unsigned flagged = 0, runs = 0;
+  for (uint8_t b = 0; b < nbauds; b++) {
+    for (const adversary* a = adversaries; a->name; a++, runs++) {
+      buildAdversary(a);
+      flagged += analyze(a->name, bauds[b], buffer);
+    }
+
+    for (const benchWorkload* w = benchWorkloads; w->name; w++, runs++) {
+      inputLength = w->generate(input, sizeof(input));
+      flagged += analyze(w->name, bauds[b], buffer);
+    }
+  }
+
+  printf("\n%u of %u runs would overrun a %u byte receive buffer\n", flagged, runs, buffer);
+  return flagged ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: lcdcost.c
+ *
+ * Runs individual lcdLib operations against the HD44780 model and reports what each costs in
+ * simulated CPU cycles, wall time and LCD bus operations.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "lcdLib.h"
+
+//---------------------------------------------------------------------------------------------
+
+typedef struct {
+  uint64_t cycles;
+  hd44780Stats lcd;
+} snapshot;
+
+static snapshot take(void) {
+  snapshot s = { hal.cycles, hal.lcd.stats };
+  return s;
+}
+
+static void report(const char* name, snapshot before) {
+  snapshot after = take();
+
+  printf("%-32s %10llu %10.1f %7llu %7llu %7llu %7llu %7llu\n", name,
+         (unsigned long long) (after.cycles - before.cycles),
+         (after.cycles - before.cycles) * 1e6 / F_CPU,
+         (unsigned long long) (after.lcd.eCycles - before.lcd.eCycles),
+         (unsigned long long) (after.lcd.instructions - before.lcd.instructions),
+         (unsigned long long) (after.lcd.dataWrites - before.lcd.dataWrites),
+         (unsigned long long) (after.lcd.dataReads - before.lcd.dataReads),
+         (unsigned long long) (after.lcd.statusReads - before.lcd.statusReads));
+}
+
+#define MEASURE(name, op) do { snapshot s = take(); op; report(name, s); } while (0)
+
+static void fillScreen(void) {
+  setCursorPosition(1, 1);
+  for (uint8_t i = 0; i < LCD_CHARACTERS_PER_SCREEN - 1; i++)
+    writeCharToLCD('a' + i % 26);
+}
+
+int main(void) {
+  halReset();
+
+#if defined (FOUR_BIT_MODE)
+  const char* mode = "FOUR_BIT_MODE";
+#elif defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
+  const char* mode = "EIGHT_BIT_ARBITRARY_PIN_MODE";
+#else
+  const char* mode = "default (8-bit)";
+#endif
+  printf("lcdLib operation costs: %s, %dx%d, F_CPU=%lu\n\n", mode, LCD_CHARACTERS_PER_LINE, LCD_NUMBER_OF_LINES, (unsigned long) F_CPU);
+  printf("%-32s %10s %10s %7s %7s %7s %7s %7s\n", "operation", "cycles", "us", "E", "instr", "write", "read", "status");
+
+  MEASURE("initLCD", initLCD());
+  MEASURE("writeCharToLCD", writeCharToLCD('x'));
+  MEASURE("writeStringToLCD (10 chars)", writeStringToLCD("0123456789"));
+  MEASURE("setCursorPosition", setCursorPosition(2, 5));
+  MEASURE("  + writeCharToLCD", writeCharToLCD('y'));
+  MEASURE("CUP, CUB, CHA", writeStringToLCD("\e[3;3H\e[2D\e[7G"));
+  MEASURE("  + writeCharToLCD", writeCharToLCD('z'));
+
+  fillScreen();
+  MEASURE("writeCharToLCD (wrap + scroll)", writeCharToLCD('!'));
+  fillScreen();
+  MEASURE("'\\n' on last line (scroll)", writeCharToLCD('\n'));
+  MEASURE("scrollUp(1)", scrollUp(1));
+  MEASURE("scrollDown(1)", scrollDown(1));
+  MEASURE("readLCDLine", { char line[LCD_CHARACTERS_PER_LINE + 1]; readLCDLine(1, line); });
+  MEASURE("readCharFromLCD", readCharFromLCD(2, 2));
+  MEASURE("lcdFill (one line)", lcdFill(1, 1, LCD_CHARACTERS_PER_LINE, ' '));
+  MEASURE("eraseInline(0)", eraseInline(0));
+  MEASURE("eraseDisplay(0)", eraseDisplay(0));
+  MEASURE("eraseDisplay(2)", eraseDisplay(2));
+  fillScreen();
+  MEASURE("insertChars(1)", insertChars(1));
+  MEASURE("deleteLines(1)", deleteLines(1));
+  MEASURE("clearDisplay", clearDisplay());
+
+  writeStringToLCD("Hello, world");
+  char screen[LCD_NUMBER_OF_LINES * (LCD_CHARACTERS_PER_LINE + 1)];
+  halRenderLCD(screen);
+
+  printf("\nbusy flag violations: %llu, data bus contention: %llu\n",
+         (unsigned long long) hal.lcd.stats.busyViolations, (unsigned long long) hal.busContention);
+  printf("screen line 1: \"%s\"\n", screen);
+
+  return strncmp(screen, "Hello, world", 12) != 0 || hal.lcd.stats.busyViolations != 0 ||
+         hal.busContention != 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: replay.c
+ *
+ * Replays a serial input capture (see uecap.h) through the uart_echo firmware on the host HAL and
+ * emits the screen after each record (a frame) along with what rendering it cost.
+ *
+ * Usage: replay [-o frames] [-g golden] capture
+ *
+ * Each record is processed until the firmware is idle again, so frames do not depend on record
+ * timing; echoed bytes are transmitted instantaneously so costs reflect processing alone. Frames
+ * are written to the given file (or standard output without -o or -g) as:
+ *
+ *   frame <n> bytes <record length> us <record delta_us> cycles <cycles> bus <bus operations>
+ *   |<display row 1>|
+ *   ...
+ *
+ * With -g, the frames are compared against a previously written frames file: the run fails if
+ * any screen differs or any frame takes more LCD bus operations than it did in the golden run.
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "harness.h"
+#include "lcdLib.h"
+#include "uecap.h"
+
+//---------------------------------------------------------------------------------------------
+
+#define SCREEN_SIZE (LCD_NUMBER_OF_LINES * (LCD_CHARACTERS_PER_LINE + 1))
+
+typedef struct {
+  uint32_t bytes;
+  uint32_t deltaUs;
+  uint64_t cycles;
+  uint64_t bus;
+  char screen[SCREEN_SIZE];
+} frame;
+
+static FILE* capture;
+static uecapRecord record;
+static uint8_t recordQueued;
+static int captureError;
+
+static frame* frames;
+static size_t frameCount, frameCapacity;
+
+static uint64_t frameStartCycles, frameStartBus;
+
+static uint64_t busOperations(void) {
+  const hd44780Stats* s = &hal.lcd.stats;
+  return s->instructions + s->dataWrites + s->dataReads + s->statusReads;
+}
+
+static frame* newFrame(void) {
+  if (frameCount == frameCapacity) {
+    frameCapacity = frameCapacity ? frameCapacity * 2 : 256;
+    frames = realloc(frames, frameCapacity * sizeof(*frames));
+    if (!frames) abort();
+  }
+  return &frames[frameCount++];
+}
+
+/*
+  Called each time the firmware has consumed its input: completes the frame of the record just
+  processed and queues the next one.
+ */
+static uint8_t onIdle(uint16_t call) {
+  (void) call;
+
+  if (recordQueued) {
+    frame* f = newFrame();
+    f->bytes = record.length;
+    f->deltaUs = record.deltaUs;
+    f->cycles = hal.cycles - frameStartCycles;
+    f->bus = busOperations() - frameStartBus;
+    halRenderLCD(f->screen);
+  }
+
+  int r = uecapReadRecord(capture, &record);
+  if (r <= 0) {
+    captureError = r < 0;
+    recordQueued = 0;
+    return 0;
+  }
+
+  frameStartCycles = hal.cycles;
+  frameStartBus = busOperations();
+  halUsartInput(record.data, record.length);
+  recordQueued = 1;
+  return 1;
+}
+
+static void writeFrames(FILE* out) {
+  for (size_t i = 0; i < frameCount; i++) {
+    const frame* f = &frames[i];
+    fprintf(out, "frame %zu bytes %lu us %lu cycles %llu bus %llu\n", i + 1,
+            (unsigned long) f->bytes, (unsigned long) f->deltaUs,
+            (unsigned long long) f->cycles, (unsigned long long) f->bus);
+    for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++)
+      fprintf(out, "|%s|\n", f->screen + row * (LCD_CHARACTERS_PER_LINE + 1));
+  }
+}
+
+/*
+  Compares the frames with those in the golden file, returning the number of regressions.
+ */
+static unsigned compareFrames(const char* golden) {
+  FILE* g = fopen(golden, "r");
+  if (!g) {
+    fprintf(stderr, "replay: can't read %s\n", golden);
+    return 1;
+  }
+
+  char line[256];
+  size_t n = 0;
+  unsigned screens = 0, costlier = 0;
+  uint64_t goldenBus = 0, goldenCycles = 0, bus = 0, cycles = 0;
+
+  while (fgets(line, sizeof(line), g)) {
+    unsigned long long gCycles, gBus;
+    size_t index;
+    if (sscanf(line, "frame %zu bytes %*u us %*u cycles %llu bus %llu", &index, &gCycles, &gBus) != 3)
+      continue;
+
+    char screen[SCREEN_SIZE];
+    for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+      char* text = screen + row * (LCD_CHARACTERS_PER_LINE + 1);
+      char* start = fgets(line, sizeof(line), g) ? strchr(line, '|') : 0;
+      char* end = start ? strrchr(line, '|') : 0;
+      size_t len = (start && end > start) ? (size_t) (end - start - 1) : 0;
+      if (len > LCD_CHARACTERS_PER_LINE) len = LCD_CHARACTERS_PER_LINE;
+      memcpy(text, start ? start + 1 : "", len);
+      text[len] = '\0';
+    }
+
+    if (n >= frameCount) {
+      printf("frame %zu: missing (capture has %zu frames)\n", index, frameCount);
+      screens++;
+      n++;
+      continue;
+    }
+
+    const frame* f = &frames[n++];
+    goldenBus += gBus;
+    goldenCycles += gCycles;
+    bus += f->bus;
+    cycles += f->cycles;
+
+    if (memcmp(screen, f->screen, SCREEN_SIZE) != 0) {
+      printf("frame %zu: screen differs\n", index);
+      for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+        printf("  golden |%s|   replay |%s|\n", screen + row * (LCD_CHARACTERS_PER_LINE + 1),
+               f->screen + row * (LCD_CHARACTERS_PER_LINE + 1));
+      }
+      screens++;
+    }
+    if (f->bus > gBus) {
+      printf("frame %zu: %llu bus operations (golden %llu)\n", index,
+             (unsigned long long) f->bus, gBus);
+      costlier++;
+    }
+  }
+  fclose(g);
+
+  if (n != frameCount) {
+    printf("golden has %zu frames, capture %zu\n", n, frameCount);
+    screens++;
+  }
+
+  printf("%zu frames: %u screens differ, %u frames cost more bus operations\n", frameCount,
+         screens, costlier);
+  printf("bus operations %llu (golden %llu), cycles %llu (golden %llu)\n",
+         (unsigned long long) bus, (unsigned long long) goldenBus,
+         (unsigned long long) cycles, (unsigned long long) goldenCycles);
+
+  return screens + costlier;
+}
+
+int main(int argc, char** argv) {
+  const char* output = 0;
+  const char* golden = 0;
+  const char* input = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      golden = argv[++i];
+    } else if (argv[i][0] != '-' && !input) {
+      input = argv[i];
+    } else {
+      input = 0;
+      break;
+    }
+  }
+  if (!input) {
+    fprintf(stderr, "usage: %s [-o frames] [-g golden] capture\n", argv[0]);
+    return 2;
+  }
+
+  capture = fopen(input, "rb");
+  if (!capture || uecapReadHeader(capture) != 0) {
+    fprintf(stderr, "%s: %s is not a capture\n", argv[0], input);
+    return 1;
+  }
+
+  halUsartTransmitPacing(0);
+  halReset();
+  harnessRun(onIdle);
+  fclose(capture);
+
+  if (captureError)
+    fprintf(stderr, "%s: %s is truncated; replayed %zu records\n", argv[0], input, frameCount);
+
+  if (output || !golden) {
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+      fprintf(stderr, "%s: can't write %s\n", argv[0], output);
+      return 1;
+    }
+    writeFrames(out);
+    if (out != stdout) fclose(out);
+  }
+
+  unsigned regressions = golden ? compareFrames(golden) : 0;
+  return (regressions || captureError) ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * File: screenEncoder.c
+ */
+
+#include <string.h>
+#include <util/crc16.h>
+
+#include "screenEncoder.h"
+
+/*
+  Appends c to out, escaped as SLIP requires, returning the new end of out.
+ */
+static uint8_t* putEscaped(uint8_t* out, uint8_t c) {
+  if (c == SCREEN_PACKET_END) {
+    *out++ = SCREEN_PACKET_ESC;
+    *out++ = SCREEN_PACKET_ESC_END;
+  } else if (c == SCREEN_PACKET_ESC) {
+    *out++ = SCREEN_PACKET_ESC;
+    *out++ = SCREEN_PACKET_ESC_ESC;
+  } else {
+    *out++ = c;
+  }
+  return out;
+}
+
+size_t screenEncodeDelta(const char* from, const char* to, size_t cells, uint8_t* out) {
+  // Cells after the last change need no operations
+  size_t end = cells;
+  while (end && from[end - 1] == to[end - 1])
+    end--;
+
+  // cost[i] is the fewest bytes encoding cells i to end; op[i] and count[i] the first operation
+  size_t cost[end + 1];
+  uint8_t op[end + 1], count[end + 1];
+  cost[end] = 0;
+
+  for (size_t i = end; i-- > 0;) {
+    cost[i] = (size_t) -1;
+
+    for (size_t k = 1; k <= SCREEN_DELTA_MAX && i + k <= end && from[i + k - 1] == to[i + k - 1]; k++) {
+      if (1 + cost[i + k] < cost[i]) {
+        cost[i] = 1 + cost[i + k];
+        op[i] = SCREEN_DELTA_SKIP;
+        count[i] = k;
+      }
+    }
+    for (size_t k = 1; k <= SCREEN_DELTA_MAX && i + k <= end && to[i + k - 1] == to[i]; k++) {
+      if (2 + cost[i + k] < cost[i]) {
+        cost[i] = 2 + cost[i + k];
+        op[i] = SCREEN_DELTA_REPEAT;
+        count[i] = k;
+      }
+    }
+    for (size_t k = 1; k <= SCREEN_DELTA_MAX && i + k <= end; k++) {
+      if (1 + k + cost[i + k] < cost[i]) {
+        cost[i] = 1 + k + cost[i + k];
+        op[i] = SCREEN_DELTA_LITERAL;
+        count[i] = k;
+      }
+    }
+  }
+
+  uint8_t* o = out;
+  for (size_t i = 0; i < end; i += count[i]) {
+    *o++ = op[i] | (count[i] - 1);
+    if (op[i] == SCREEN_DELTA_LITERAL) {
+      memcpy(o, to + i, count[i]);
+      o += count[i];
+    } else if (op[i] == SCREEN_DELTA_REPEAT) {
+      *o++ = to[i];
+    }
+  }
+
+  return o - out;
+}
+
+size_t screenFramePacket(uint8_t seq, uint8_t type, const uint8_t* payload, size_t length, uint8_t* out) {
+  uint8_t* o = out;
+  uint16_t crc = 0xffff;
+
+  *o++ = SCREEN_PACKET_END; // Flushes any line noise preceding the packet
+
+  crc = _crc_ccitt_update(crc, seq);
+  o = putEscaped(o, seq);
+  crc = _crc_ccitt_update(crc, type);
+  o = putEscaped(o, type);
+  for (size_t i = 0; i < length; i++) {
+    crc = _crc_ccitt_update(crc, payload[i]);
+    o = putEscaped(o, payload[i]);
+  }
+  o = putEscaped(o, crc & 0xff);
+  o = putEscaped(o, crc >> 8);
+
+  *o++ = SCREEN_PACKET_END;
+  return o - out;
+}
+
+size_t screenEncodeUpdate(const char* from, const char* to, size_t cells, uint8_t seq, uint8_t* out) {
+  if (from) {
+    uint8_t delta[cells + cells / SCREEN_DELTA_MAX + 1];
+    size_t length = screenEncodeDelta(from, to, cells, delta);
+
+    if (length == 0)
+      return 0;
+    if (length < cells)
+      return screenFramePacket(seq, SCREEN_PACKET_DELTA, delta, length, out);
+  }
+
+  return screenFramePacket(seq, SCREEN_PACKET_SCREEN, (const uint8_t*) to, cells, out);
+}
+
+size_t screenUnframePacket(const uint8_t* frame, size_t length, uint8_t* out) {
+  uint8_t* o = out;
+  uint16_t crc = 0xffff;
+
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = frame[i];
+
+    if (c == SCREEN_PACKET_END)
+      continue;
+    if (c == SCREEN_PACKET_ESC && i + 1 < length) {
+      c = frame[++i];
+      if (c == SCREEN_PACKET_ESC_END)
+        c = SCREEN_PACKET_END;
+      else if (c == SCREEN_PACKET_ESC_ESC)
+        c = SCREEN_PACKET_ESC;
+      else
+        return 0;
+    }
+
+    crc = _crc_ccitt_update(crc, c);
+    *o++ = c;
+  }
+
+  // The CRC over the packet including its (little endian) CRC is zero when intact
+  if (o - out < 4 || crc)
+    return 0;
+  return o - out - 2;
+}
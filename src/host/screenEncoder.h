@@ -0,0 +1,70 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file screenEncoder.h
+ * @brief Host side encoder for the binary screen update packets of screenPacket.h.
+ *
+ * A host driving the display keeps a copy of the screen the device is showing (as acknowledged)
+ * and encodes each new frame against it: only the changed cells are sent, with runs of the same
+ * character compressed, falling back to a full screen when that is no larger.
+ */
+
+#ifndef SCREEN_ENCODER_H
+#define SCREEN_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "screenPacket.h"
+
+/**
+   Largest framed packet: a leading and trailing SCREEN_PACKET_END around a packet in which
+   every byte is escaped.
+ */
+#define SCREEN_ENCODER_FRAME_MAX (2 * SCREEN_PACKET_MAX + 2)
+
+/**
+   Encodes the SCREEN_PACKET_DELTA operations that turn the cells of from into those of to,
+   returning the number of bytes written to out (zero if the screens are the same). The encoding
+   is the shortest possible; out must hold cells + cells / SCREEN_DELTA_MAX + 1 bytes.
+ */
+size_t screenEncodeDelta(const char* from, const char* to, size_t cells, uint8_t* out);
+
+/**
+   Frames a packet of the given type and payload with its CRC, writing at most
+   SCREEN_ENCODER_FRAME_MAX bytes to out and returning the number written.
+ */
+size_t screenFramePacket(uint8_t seq, uint8_t type, const uint8_t* payload, size_t length, uint8_t* out);
+
+/**
+   Frames the smaller of a SCREEN_PACKET_DELTA and a SCREEN_PACKET_SCREEN packet updating the
+   screen from from to to (always the latter if from is null), returning the number of bytes
+   written to out (at most SCREEN_ENCODER_FRAME_MAX), or zero if there is nothing to send. cells
+   must equal LCD_CHARACTERS_PER_SCREEN of the device.
+ */
+size_t screenEncodeUpdate(const char* from, const char* to, size_t cells, uint8_t seq, uint8_t* out);
+
+/**
+   Decodes one SLIP framed packet from the device (such as a SCREEN_PACKET_SNAPSHOT) held in
+   frame (with or without its END bytes), writing seq, type and payload to out (which must hold
+   length bytes). Returns the number of bytes written, or zero if the frame is corrupt.
+ */
+size_t screenUnframePacket(const uint8_t* frame, size_t length, uint8_t* out);
+
+#endif /* SCREEN_ENCODER_H */
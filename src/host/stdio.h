@@ -0,0 +1,47 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file stdio.h
+ * @brief Host stand in for the avr-libc extensions to <stdio.h> (the ones used by this project).
+ *
+ * avr-libc streams are a FILE holding put and get functions; here fdev_setup_stream points the
+ * given FILE* variable at an unbuffered host stream calling the same functions (see halStream).
+ */
+
+#ifndef HOST_STDIO_H
+#define HOST_STDIO_H
+
+#include_next <stdio.h>
+
+#include "hal.h"
+
+#define _FDEV_SETUP_READ  1
+#define _FDEV_SETUP_WRITE 2
+#define _FDEV_SETUP_RW    (_FDEV_SETUP_READ | _FDEV_SETUP_WRITE)
+
+#define _FDEV_ERR (-1)
+#define _FDEV_EOF (-2)
+
+#define fdev_setup_stream(stream, put, get, rwflag) ((stream) = halStream((put), (get), (rwflag)))
+
+#define printf_P   printf
+#define fprintf_P  fprintf
+#define vfprintf_P vfprintf
+#define fputs_P    fputs
+
+#endif /* HOST_STDIO_H */
@@ -0,0 +1,61 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: uecap.c
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <string.h>
+
+#include "uecap.h"
+
+//---------------------------------------------------------------------------------------------
+
+int uecapWriteHeader(FILE* f) {
+  return fwrite(UECAP_MAGIC, 1, UECAP_MAGIC_SIZE, f) == UECAP_MAGIC_SIZE ? 0 : -1;
+}
+
+int uecapWriteRecord(FILE* f, uint32_t deltaUs, const uint8_t* data, uint16_t length) {
+  uint8_t header[6] = {
+    deltaUs & 0xff, (deltaUs >> 8) & 0xff, (deltaUs >> 16) & 0xff, (deltaUs >> 24) & 0xff,
+    length & 0xff, (length >> 8) & 0xff
+  };
+
+  if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) return -1;
+  return fwrite(data, 1, length, f) == length ? 0 : -1;
+}
+
+int uecapReadHeader(FILE* f) {
+  char magic[UECAP_MAGIC_SIZE];
+
+  if (fread(magic, 1, UECAP_MAGIC_SIZE, f) != UECAP_MAGIC_SIZE) return -1;
+  return memcmp(magic, UECAP_MAGIC, UECAP_MAGIC_SIZE) == 0 ? 0 : -1;
+}
+
+int uecapReadRecord(FILE* f, uecapRecord* r) {
+  uint8_t header[6];
+  size_t n = fread(header, 1, sizeof(header), f);
+
+  if (n == 0) return 0;
+  if (n != sizeof(header)) return -1;
+
+  r->deltaUs = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t) header[3] << 24;
+  r->length = header[4] | header[5] << 8;
+
+  return fread(r->data, 1, r->length, f) == r->length ? 1 : -1;
+}
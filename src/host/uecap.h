@@ -0,0 +1,66 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file uecap.h
+ * @brief Capture format for raw serial input streams.
+ *
+ * A capture is the magic "UECAP1" followed by records, each made of:
+ * - delta_us: time since the previous record (or start of capture) in microseconds, uint32
+ *   little endian
+ * - length: number of data bytes, uint16 little endian
+ * - data: the bytes received
+ */
+
+#ifndef UECAP_H
+#define UECAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define UECAP_MAGIC      "UECAP1"
+#define UECAP_MAGIC_SIZE 6
+#define UECAP_RECORD_MAX 0xffff
+
+typedef struct {
+  uint32_t deltaUs;
+  uint16_t length;
+  uint8_t data[UECAP_RECORD_MAX];
+} uecapRecord;
+
+/**
+   Writes the capture header to f. Returns 0 on success.
+ */
+int uecapWriteHeader(FILE* f);
+
+/**
+   Appends a record to f. Returns 0 on success.
+ */
+int uecapWriteRecord(FILE* f, uint32_t deltaUs, const uint8_t* data, uint16_t length);
+
+/**
+   Reads and checks the capture header from f. Returns 0 on success.
+ */
+int uecapReadHeader(FILE* f);
+
+/**
+   Reads the next record from f. Returns 1 if a record was read, 0 at the end of the capture and
+   -1 if the capture is truncated.
+ */
+int uecapReadRecord(FILE* f, uecapRecord* r);
+
+#endif /* UECAP_H */
@@ -0,0 +1,38 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file util/crc16.h
+ * @brief Host stand in for avr-libc's <util/crc16.h> (the functions used by this project).
+ */
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/**
+   CRC-CCITT (polynomial 0x8408, reflected) update as computed by avr-libc.
+ */
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xff;
+  data ^= data << 4;
+
+  return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3));
+}
+
+#endif /* HOST_UTIL_CRC16_H */
@@ -0,0 +1,31 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file util/setbaud.h
+ * @brief Host stand in for avr-libc's <util/setbaud.h> (normal speed mode only).
+ */
+
+#ifndef HOST_UTIL_SETBAUD_H
+#define HOST_UTIL_SETBAUD_H
+
+#define UBRR_VALUE  ((F_CPU + 8UL * BAUD) / (16UL * BAUD) - 1UL)
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+#define USE_2X      0
+
+#endif /* HOST_UTIL_SETBAUD_H */
@@ -0,0 +1,134 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: workloads.c
+ */
+
+// Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+
+#include "workloads.h"
+
+//---------------------------------------------------------------------------------------------
+
+static const char* words[] = {
+  "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "serial", "terminal",
+  "character", "display", "echo", "line", "buffer", "sensor", "value", "status"
+};
+
+/*
+  Append the string str to buf (of size bytes, with len used), returning the new length.
+ */
+static size_t append(uint8_t* buf, size_t size, size_t len, const char* str) {
+  size_t n = strlen(str);
+  if (len + n > size) n = size - len;
+  memcpy(buf + len, str, n);
+  return len + n;
+}
+
+static size_t text(uint8_t* buf, size_t size) {
+  size_t len = 0, col = 0;
+  for (unsigned i = 0; len < 4000; i++) {
+    const char* w = words[(i * 7) % (sizeof(words) / sizeof(*words))];
+    len = append(buf, size, len, w);
+    col += strlen(w);
+    if (col > 60) {
+      len = append(buf, size, len, "\r");
+      col = 0;
+    } else {
+      len = append(buf, size, len, " ");
+      col++;
+    }
+  }
+  return len;
+}
+
+static size_t logLines(uint8_t* buf, size_t size) {
+  size_t len = 0;
+  char line[32];
+  for (unsigned i = 0; len < 4000; i++) {
+    snprintf(line, sizeof(line), "[%5u] %s ok\r", i, words[i % (sizeof(words) / sizeof(*words))]);
+    len = append(buf, size, len, line);
+  }
+  return len;
+}
+
+static size_t dashboard(uint8_t* buf, size_t size) {
+  size_t len = 0;
+  char update[96];
+  len = append(buf, size, len, "\f\e[?25lTemp:\e[2;1HRPM:\e[3;1HLoad:\e[4;1HUp:");
+  for (unsigned i = 0; len < 4000; i++) {
+    snprintf(update, sizeof(update), "\e[1;7H%2u.%uC\e[2;6H%4u\e[3;7H%3u%%\e[4;5H%5us",
+             20 + i % 10, i % 10, 1000 + (i * 37) % 4000, (i * 13) % 101, i);
+    len = append(buf, size, len, update);
+  }
+  return len;
+}
+
+static size_t gauges(uint8_t* buf, size_t size) {
+  size_t len = 0;
+  char update[64];
+  // Laid out within the first two lines and 16 columns
+  len = append(buf, size, len, "\f\e[?25lCPU \e[=0;10b\e[2;1H\e[=3;5s\e[2;7H\e[=1;8b"
+                               "\e[2;16H\e[=2;2c");
+  for (unsigned i = 0; len < 4000; i++) {
+    snprintf(update, sizeof(update), "\e[=0;%uv\e[=1;%uv\e[=2;%uv\e[=3;%uv",
+             (i * 37) % 256, 128 + (i * 3) % 64, (i * 11) % 256, (i * 53) % 256);
+    len = append(buf, size, len, update);
+  }
+  return len;
+}
+
+static size_t curses(uint8_t* buf, size_t size) {
+  size_t len = 0;
+  char update[96];
+  for (unsigned i = 0; len < 4000; i++) {
+    switch (i % 6) {
+    case 0: // Redraw
+      snprintf(update, sizeof(update), "\e[1;1H\e[2J\e[?25l menu %u\e[2;1H> item\e[3;1H  item\e[?25h", i);
+      break;
+    case 1: // Scrolling region with a fixed header
+      snprintf(update, sizeof(update), "\e[2;4r\e[4;1H\r\nentry %u\e[1;4r", i);
+      break;
+    case 2: // Insert and delete characters
+      snprintf(update, sizeof(update), "\e[2;3H\e[2@ab\e[3;3H\e[1P");
+      break;
+    case 3: // Insert and delete lines
+      snprintf(update, sizeof(update), "\e[2;1H\e[1Lnew %u\e[4;1H\e[1M", i);
+      break;
+    case 4: // Erase to end of line and status update
+      snprintf(update, sizeof(update), "\e[4;1H\e[0Kstatus %u\e[1;18H\e[2X", i);
+      break;
+    default: // Cursor motion
+      snprintf(update, sizeof(update), "\e[s\e[3;1H\e[2C\e[1A\e[4G\e[u");
+      break;
+    }
+    len = append(buf, size, len, update);
+  }
+  return len;
+}
+
+const benchWorkload benchWorkloads[] = {
+  { "text", text },
+  { "log", logLines },
+  { "dashboard", dashboard },
+  { "gauges", gauges },
+  { "curses", curses },
+  { 0, 0 }
+};
@@ -0,0 +1,46 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file workloads.h
+ * @brief Representative serial input streams used by the host benchmark and analysis tools.
+ */
+
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_WORKLOAD_MAX 8192
+
+typedef struct {
+  const char* name;
+  size_t (*generate)(uint8_t* buf, size_t size); ///< Fills buf, returning the length used
+} benchWorkload;
+
+/**
+   Null terminated list of workloads:
+   - text:      prose typed or pasted with a carriage return every ~60 characters
+   - log:       short log lines (line feed heavy)
+   - dashboard: labelled values updated in place using cursor positioning
+   - gauges:    bars and a sparkline updated through the widget sequences (see defineLCDWidget)
+   - curses:    full screen application output (erase, margins, insert/delete, cursor hiding)
+ */
+extern const benchWorkload benchWorkloads[];
+
+#endif /* WORKLOADS_H */
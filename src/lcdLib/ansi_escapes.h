@@ -40,17 +40,31 @@
 #define SU(n) CSI #n "S"            ///< Scroll up
 #define SD(n) CSI #n "T"            ///< Scroll down
 
+#define ICH(n) CSI #n "@"           ///< Insert characters
+#define DCH(n) CSI #n "P"           ///< Delete characters
+#define ECH(n) CSI #n "X"           ///< Erase characters
+#define IL(n) CSI #n "L"            ///< Insert lines
+#define DL(n) CSI #n "M"            ///< Delete lines
+
 #define HVP(n,m) CSI #n ";" #m "f"  ///< Horizontal and vertical position
 
+#define DECSTBM(n,m) CSI #n ";" #m "r" ///< Set top and bottom margins (scrolling region)
+
 // #define SGR(n,m) CSI #n #m         ///< Select graphic rendition
 
 #define AUX_ON  CSI "5i"             ///< AUX port on
 #define AUX_OFF CSI "4i"             ///< AUX port off
 
-// #define DSR CSI "6 n"             ///< Device status report
+#define DSR CSI "6n"                 ///< Device status report (replied to with a cursor position report)
 
 #define SCP CSI "s"                  ///< Save cursor position
 #define RCP CSI "u"                  ///< Restore cursor position
 
 #define HIDE_CURSOR CSI "?25l"       ///< DECTCEM: hide cursor
 #define SHOW_CURSOR CSI "?25h"       ///< DECTCEM: show cursor
+
+// Private sequences for the widgets of lcdLib (see defineLCDWidget)
+#define WIDGET_HBAR(i,n)      CSI "=" #i ";" #n "b" ///< Horizontal bar of n cells at the cursor
+#define WIDGET_VBAR(i,n)      CSI "=" #i ";" #n "c" ///< Vertical bar of n cells up from the cursor
+#define WIDGET_SPARKLINE(i,n) CSI "=" #i ";" #n "s" ///< Sparkline of n cells at the cursor
+#define WIDGET_SET(i,v)       CSI "=" #i ";" #v "v" ///< Set widget i to v (0-255)
@@ -23,10 +23,21 @@
 
 // Includes -----------------------------------------------------------------------------------
 #include <math.h>
+#include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
 
 #include "lcdLib.h"
+#include "profile.h"
+
+#ifdef LCD_CHECKPOINT_ENABLE
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#endif
+
+#ifdef PCF8574_MODE
+#include <avr/interrupt.h>
+#endif
 
 //---------------------------------------------------------------------------------------------
 // Static global variables
@@ -39,35 +50,344 @@ static volatile uint8_t saveCursorLineChars;
 
 static volatile uint8_t lcdState;
 
+// Scrolling region (DECSTBM) as zero based physical line numbers (inclusive)
+static volatile uint8_t scrollTop;
+static volatile uint8_t scrollBottom = LCD_NUMBER_OF_LINES - 1;
+
+// Non-zero when the LCD address counter does not match the cursor position; the DDRAM address
+// instruction is deferred until the next data write or visible cursor change
+static volatile uint8_t cursorAddrStale;
+
 static const uint8_t lineBeginnings[LCD_NUMBER_OF_LINES] = { LCD_LINE_BEGINNINGS };
 
+static void (*responseHandler)(const char*);
+
+#ifdef LCD_ANSI_ESCAPE_ENABLE
+// Escape sequence written to the LCD stream so far (null terminated when complete) and its length,
+// zero outside of a sequence
+static char streamEscape[11];
+static uint8_t streamEscapeLength;
+#endif
+
+#ifdef LCD_SHADOW_ENABLE
+// Copy of the visible DDRAM contents (row major) and of the LCD address counter; the address is
+// SHADOW_ADDR_CGRAM while the address counter points into CGRAM
+static char shadow[LCD_CHARACTERS_PER_SCREEN];
+static uint8_t shadowAddr;
+
+// Non-zero between beginLCDBurst and endLCDBurst, when DDRAM changes are only made to the
+// shadow; lines changed meanwhile have their bit (1 << row) set in burstDirty
+static uint8_t burst;
+static uint8_t burstDirty;
+
+#define SHADOW_ADDR_CGRAM 0xff
+#endif
+
+#ifdef LCD_BF_TIMEOUT
+// Non-zero while the LCD is faulted (a busy flag wait timed out and recovery failed); busy flag
+// waits are then skipped so that rendering does not stall until recoverLCD succeeds
+static uint8_t lcdFault;
+static uint8_t recovering;
+static uint16_t lcdFaultCount;
+#endif
+
+#ifdef LCD_WRITE_ONLY
+// Execution time still owed to the last transfer, as the busy flag can't be read (see
+// waitLCDExecution)
+static uint8_t lcdPending;
+
+#define LCD_PENDING_NONE  0
+#define LCD_PENDING_SHORT 1
+#define LCD_PENDING_CLEAR 2
+#define LCD_PENDING_HOME  3
+#endif
+
+#ifdef PCF8574_MODE
+// Levels of the expander pins, which stand in for the IO pins (see lcdLib.h); writes to the
+// direction registers go to lcdExpanderDdr and are ignored
+static uint8_t lcdExpander;
+static uint8_t lcdExpanderDdr;
+
+// Expander levels waiting to be sent; the TWI interrupt sends them in a single transaction for
+// as long as the buffer does not run dry
+static volatile uint8_t expanderBuffer[LCD_PCF8574_BUFFER_SIZE];
+static volatile uint8_t expanderHead;       // next free slot (written by caller)
+static volatile uint8_t expanderTail;       // next byte to send (written by ISR)
+static volatile uint8_t expanderActive;     // a transaction is in progress
+static volatile uint8_t expanderFailed;     // the expander stopped acknowledging
+static uint8_t expanderLast;                // the level queued last
+#endif
+
+#ifdef HC595_MODE
+// Levels of the shift register outputs, which stand in for the IO pins (see lcdLib.h); writes to
+// the direction registers go to lcdShiftRegisterDdr and are ignored
+static uint8_t lcdShiftRegister;
+static uint8_t lcdShiftRegisterDdr;
+static uint8_t shiftRegisterLast;           // the levels on the outputs
+#endif
+
+#ifdef LCD_WIDGET_ENABLE
+// Rows (five pixels each) of the CGRAM characters as written to the LCD, 0xff where unknown, and
+// the characters in use by widgets (one bit each)
+static uint8_t glyphs[8][8];
+static uint8_t glyphsUsed;
+
+typedef struct {
+  uint8_t type;
+  uint8_t row, column;  // zero based; the bottom cell of a vertical bar
+  uint8_t length;       // cells
+  uint8_t glyph;        // first CGRAM character
+  uint8_t value;
+} lcdWidget;
+
+static lcdWidget widgets[LCD_WIDGET_COUNT];
+
+// Widgets show CGRAM character n through its alias n + 8, so that no screen cell holds a null
+#define WIDGET_CHAR(glyph) ((char) (0x08 + (glyph)))
+#define WIDGET_FULL        ((char) 0xff) // Solid block of the character ROM
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+// Each checkpoint slot holds a sequence number, the cursor row and column, lcdState, the screen
+// and a CRC (little endian) over them and the geometry; slots are written in turn
+#define CHECKPOINT_HEADER 4
+#define CHECKPOINT_SLOT   (CHECKPOINT_HEADER + LCD_CHARACTERS_PER_SCREEN + 2)
+#define CHECKPOINT_SLOTS  (LCD_CHECKPOINT_EEPROM_SIZE / CHECKPOINT_SLOT)
+
+static uint8_t checkpointSlot = CHECKPOINT_SLOTS; // Slot of the newest checkpoint (none)
+static uint8_t checkpointSeq;                     // and its sequence number
+
+// Checkpoint being written: its header, slot, next byte and running CRC
+static uint8_t checkpointHeader[CHECKPOINT_HEADER];
+static uint8_t checkpointTarget;
+static uint16_t checkpointNext;
+static uint16_t checkpointCrc;
+static uint8_t checkpointWriting;
+#endif
+
 //---------------------------------------------------------------------------------------------
 // Static functions
 
+#ifdef PCF8574_MODE
+#ifndef TWI_INTERRUPT_FLAG                  // overridden by host (off-target) builds
+#define TWI_INTERRUPT_FLAG() (TWCR & (1 << TWINT))
+#endif
+
+#if F_CPU / LCD_PCF8574_BIT_RATE < 18
+#error "LCD_PCF8574_BIT_RATE is too high for F_CPU"
+#endif
+#define EXPANDER_TWBR        ((F_CPU / LCD_PCF8574_BIT_RATE - 16) / 2) // Prescaler of 1
+#define EXPANDER_CONTROL     ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+#define EXPANDER_BUFFER_MASK (LCD_PCF8574_BUFFER_SIZE - 1)
+
+// Bytes (of nine bit times each) that a transfer has to take so that it completes no sooner than
+// LCD_GENERIC_INSTR_DELAY after the previous one; a transfer itself is four bytes (enable raised
+// and lowered for each nibble), any more are filled in after the previous one
+#define EXPANDER_INSTR_BYTES ((LCD_GENERIC_INSTR_DELAY * (LCD_PCF8574_BIT_RATE / 1000UL) + 8999) / 9000)
+#define EXPANDER_FILL        (EXPANDER_INSTR_BYTES > 4 ? EXPANDER_INSTR_BYTES - 4 : 0)
+
+/*
+  Advance the transaction with the expander after a TWI event: address it after the start, send
+  the queued bytes while it acknowledges them, and stop once the buffer has run dry. If the
+  expander does not acknowledge, the bytes queued are dropped.
+ */
+static void expanderStep(void) {
+  switch (TWSR & 0xf8) {
+  case 0x08:                                // START sent
+  case 0x10:                                // Repeated START sent
+    TWDR = LCD_PCF8574_ADDRESS << 1;        // SLA+W
+    TWCR = EXPANDER_CONTROL;
+    return;
+  case 0x18:                                // SLA+W sent, ACK received
+  case 0x28:                                // Data sent, ACK received
+    if (expanderHead != expanderTail) {
+      TWDR = expanderBuffer[expanderTail];
+      expanderTail = (expanderTail + 1) & EXPANDER_BUFFER_MASK;
+      TWCR = EXPANDER_CONTROL;
+      return;
+    }
+    break;
+  default:                                  // Not acknowledged, or the bus was lost
+    expanderTail = expanderHead;
+    expanderFailed = 1;
+  }
+
+  TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+  expanderActive = 0;
+}
+
+ISR(TWI_vect) {
+  expanderStep();
+}
+
+/*
+  Queue the given levels of the expander pins, starting a transaction if none is in progress.
+ */
+static void queueExpander(uint8_t b) {
+  uint8_t sreg = SREG;
+  uint8_t next;
+
+  for (;;) {
+    cli();
+    next = (expanderHead + 1) & EXPANDER_BUFFER_MASK;
+    if (next != expanderTail) break;        // Room in the buffer
+
+    if (!(sreg & (1 << SREG_I))) {
+      // With interrupts disabled the buffer can't drain by itself; advance the transaction by
+      // polling instead
+      if (TWI_INTERRUPT_FLAG())
+        expanderStep();
+    } else {
+      SREG = sreg;                          // Let the buffer drain
+    }
+  }
+
+  expanderBuffer[expanderHead] = b;
+  expanderHead = next;
+  expanderLast = b;
+
+  if (!expanderActive) {
+    while (TWCR & (1 << TWSTO))             // The previous transaction is still stopping
+      ;
+    expanderActive = 1;
+    TWCR = EXPANDER_CONTROL | (1 << TWSTA);
+  }
+  SREG = sreg;
+}
+
+/*
+  Wait until every byte queued has been sent to the expander.
+ */
+static void flushExpander(void) {
+  while (expanderActive) {
+    if (!(SREG & (1 << SREG_I)) && TWI_INTERRUPT_FLAG())
+      expanderStep();
+  }
+}
+
+// Delays for the LCD start from the last byte sent to the expander
+#define lcdDelayUs(us) do { flushExpander(); _delay_us(us); } while (0)
+#else
+#define lcdDelayUs(us) _delay_us(us)
+#endif
+
+#ifdef HC595_MODE
+#ifndef SPI_TRANSMIT_DATA                   // overridden by host (off-target) builds
+#define SPI_TRANSMIT_DATA(data) (SPDR = (data))
+#endif
+
+/*
+  Shift lcdShiftRegister out on the SPI and latch it onto the shift register outputs, unless they
+  already have these levels. At F_CPU/2 the byte takes 16 cycles.
+ */
+static void latchShiftRegister(void) {
+  if (lcdShiftRegister == shiftRegisterLast)
+    return;
+
+  SPI_TRANSMIT_DATA(lcdShiftRegister);
+  shiftRegisterLast = lcdShiftRegister;
+  loop_until_bit_is_set(SPSR, SPIF);        // Cleared by the next write of SPDR
+
+  LCD_HC595_LATCH_PORT |= (1 << LCD_HC595_LATCH);
+  LCD_HC595_LATCH_PORT &= ~(1 << LCD_HC595_LATCH);
+}
+#endif
+
 /*
   Bring LCD_ENABLE line high, wait for LCD_ENABLE_HIGH_DELAY; then bring LCD_ENABLE line low
-  and wait for LCD_ENABLE_LOW_DELAY.
+  and wait for LCD_ENABLE_LOW_DELAY (except with HC595_MODE).
 
   Note: LCD_ENABLE, LCD_ENABLE_HIGH_DELAY, and LCD_ENABLE_LOW_DELAY must be defined in lcdLibConfig.h
  */
 static void clkLCD(void) {
+#ifdef PCF8574_MODE
+  // Each byte to the expander lasts long enough for the enable pulse; RS and RW get one of their
+  // own before enable rises when they change
+  if ((lcdExpander ^ expanderLast) & ((1 << LCD_RS) | (1 << LCD_RW)))
+    queueExpander(lcdExpander & ~(1 << LCD_ENABLE));
+  queueExpander(lcdExpander | (1 << LCD_ENABLE));
+  queueExpander(lcdExpander & ~(1 << LCD_ENABLE));
+#else
+#ifdef HC595_MODE
+  // RS, RW and the data lines settle (one byte per nibble) before enable rises
+  latchShiftRegister();
+#endif
   LCD_ENABLE_PORT |= (1 << LCD_ENABLE);
   _delay_us(LCD_ENABLE_HIGH_DELAY);
   LCD_ENABLE_PORT &= ~(1 << LCD_ENABLE);
+  // With HC595_MODE the lines only change once the next byte has been shifted out and latched,
+  // which outlasts the hold times; waitLCDExecution waits from here instead
+#ifndef HC595_MODE
   _delay_us(LCD_ENABLE_LOW_DELAY);
+#endif
+#endif
 }
 
 /*
-  Wait until LCD_BF (busy flag) is cleared (low).
+  Set all pins of LCD_DBUS as outputs
+*/
+static inline void setLCDDBusAsOutputs(void) {
+#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
+  LCD_DBUS7_DDR |= (1 << LCD_DBUS7);
+  LCD_DBUS6_DDR |= (1 << LCD_DBUS6);
+  LCD_DBUS5_DDR |= (1 << LCD_DBUS5);
+  LCD_DBUS4_DDR |= (1 << LCD_DBUS4);
+#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
+  LCD_DBUS3_DDR |= (1 << LCD_DBUS3);
+  LCD_DBUS2_DDR |= (1 << LCD_DBUS2);
+  LCD_DBUS1_DDR |= (1 << LCD_DBUS1);
+  LCD_DBUS0_DDR |= (1 << LCD_DBUS0);
+#endif
+#else
+  LCD_DBUS_DDR = 0xff;
+#endif
+}
+
+/*
+  Set all pins of LCD_DBUS as inputs (disabling their output)
+*/
+static inline void setLCDDBusAsInputs(void) {
+#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
+  LCD_DBUS7_DDR &= ~(1 << LCD_DBUS7);
+  LCD_DBUS6_DDR &= ~(1 << LCD_DBUS6);
+  LCD_DBUS5_DDR &= ~(1 << LCD_DBUS5);
+  LCD_DBUS4_DDR &= ~(1 << LCD_DBUS4);
+#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
+  LCD_DBUS3_DDR &= ~(1 << LCD_DBUS3);
+  LCD_DBUS2_DDR &= ~(1 << LCD_DBUS2);
+  LCD_DBUS1_DDR &= ~(1 << LCD_DBUS1);
+  LCD_DBUS0_DDR &= ~(1 << LCD_DBUS0);
+#endif
+#else
+  LCD_DBUS_DDR = 0;
+#endif
+}
+
+#ifndef LCD_WRITE_ONLY
+#ifdef FOUR_BIT_MODE
+#define LCD_BF_POLL_US 4 // Each poll takes at least 4us (two enable pulses)
+#else
+#define LCD_BF_POLL_US 2 // Each poll takes at least 2us
+#endif
+
+/*
+  Poll LCD_BF (busy flag) until it is cleared (low). Sets RS=0 and RW=1 but leaves the data
+  bus direction untouched; the caller must ensure the data bus is configured as inputs.
+
+  LCD_BF is pulled up, so that it reads busy (and the wait times out) with no LCD attached. The
+  pull-up is left set; data writes set or clear every data line, LCD_BF included, explicitly.
+
+  Returns non-zero if LCD_BF_TIMEOUT is defined and the busy flag did not clear within it.
  */
-static void loop_until_LCD_BF_clear(void) {
+static uint8_t pollLCDBusyFlag_(void) {
   uint8_t bf;
+#ifdef LCD_BF_TIMEOUT
+  uint16_t polls = LCD_BF_TIMEOUT / LCD_BF_POLL_US;
+#endif
 
-  LCD_RS_PORT &= ~(1 << LCD_RS); // RS=0
-  LCD_RW_PORT |= (1 << LCD_RW);  // RW=1
-
-  // Set LCD_BF as input
-  LCD_DBUS7_DDR &= ~(1 << LCD_BF);
+  LCD_DBUS7_PORT |= (1 << LCD_BF); // Pull-up
+  LCD_RS_PORT &= ~(1 << LCD_RS);   // RS=0
+  LCD_RW_PORT |= (1 << LCD_RW);    // RW=1
 
   do {
     bf = 0;
@@ -85,21 +405,99 @@ static void loop_until_LCD_BF_clear(void) {
     LCD_ENABLE_PORT &= ~(1 << LCD_ENABLE);
     _delay_us(1);                          // 'address hold time', 'data hold time' and 'enable cycle width'
 #endif
+
+#ifdef LCD_BF_TIMEOUT
+    if (bf && !--polls)
+      return 1;
+#endif
   } while (bf);
 
-#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
-  LCD_DBUS7_DDR |= (1 << LCD_DBUS7);
-  LCD_DBUS6_DDR |= (1 << LCD_DBUS6);
-  LCD_DBUS5_DDR |= (1 << LCD_DBUS5);
-  LCD_DBUS4_DDR |= (1 << LCD_DBUS4);
-#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
-  LCD_DBUS3_DDR |= (1 << LCD_DBUS3);
-  LCD_DBUS2_DDR |= (1 << LCD_DBUS2);
-  LCD_DBUS1_DDR |= (1 << LCD_DBUS1);
-  LCD_DBUS0_DDR |= (1 << LCD_DBUS0);
+  return 0;
+}
+#else
+/*
+  Wait out the execution time of the last transfer, as the busy flag can't be read. Through the
+  expander the bus time of the transfers covers most of it (see EXPANDER_FILL); clears and
+  returns home wait for the bytes queued to be sent first.
+
+  Returns non-zero if the expander stopped acknowledging (PCF8574_MODE).
+ */
+static uint8_t waitLCDExecution(void) {
+  uint8_t pending = lcdPending;
+  lcdPending = LCD_PENDING_NONE;
+
+  if (pending == LCD_PENDING_CLEAR) {
+    lcdDelayUs(LCD_CLEAR_DISPLAY_DELAY);
+  } else if (pending == LCD_PENDING_HOME) {
+    lcdDelayUs(LCD_RETURN_HOME_DELAY);
+  } else if (pending == LCD_PENDING_SHORT) {
+#ifdef PCF8574_MODE
+    for (uint8_t i = 0; i < EXPANDER_FILL; i++)
+      queueExpander(expanderLast);
+#elif defined (HC595_MODE)
+    _delay_us(LCD_GENERIC_INSTR_DELAY);     // clkLCD doesn't wait after enable falls
+#elif LCD_GENERIC_INSTR_DELAY > LCD_ENABLE_LOW_DELAY
+    // The instruction has been executing since enable fell, LCD_ENABLE_LOW_DELAY ago (clkLCD)
+    _delay_us(LCD_GENERIC_INSTR_DELAY - LCD_ENABLE_LOW_DELAY);
 #endif
+  }
+
+#ifdef PCF8574_MODE
+  uint8_t failed = expanderFailed;
+  expanderFailed = 0;
+  return failed;
 #else
-  LCD_DBUS_DDR = 0xff; // Reset all LCD_DBUS_PORT pins as outputs
+  return 0;
+#endif
+}
+#endif
+
+/*
+  Wait until LCD_BF (busy flag) is cleared (low).
+
+  If LCD_BF_TIMEOUT is defined and the wait times out, the fault is counted and the LCD is
+  recovered (see recoverLCD); while it stays faulted the wait returns immediately.
+ */
+static void loop_until_LCD_BF_clear(void) {
+#ifdef LCD_SHADOW_ENABLE
+  if (burst) // Only the shadow is written; instructions passed on to the LCD wait themselves
+    return;
+#endif
+#ifdef LCD_BF_TIMEOUT
+  if (lcdFault)
+    return;
+#endif
+
+  PROFILE_BEGIN(PROFILE_BF_WAIT);
+
+#ifdef LCD_WRITE_ONLY
+#ifdef LCD_BF_TIMEOUT
+  uint8_t timedOut = waitLCDExecution();
+#else
+  waitLCDExecution();
+#endif
+#else
+  // The LCD drives the whole data bus while RW=1, so none of it may be an output
+  setLCDDBusAsInputs();
+
+#ifdef LCD_BF_TIMEOUT
+  uint8_t timedOut = pollLCDBusyFlag_();
+#else
+  pollLCDBusyFlag_();
+#endif
+
+  setLCDDBusAsOutputs();
+#endif
+
+  PROFILE_END(PROFILE_BF_WAIT);
+
+#ifdef LCD_BF_TIMEOUT
+  if (timedOut) {
+    lcdFault = 1;
+    lcdFaultCount++;
+    if (!recovering) // A timeout during recovery leaves the LCD faulted
+      recoverLCD();
+  }
 #endif
 }
 
@@ -169,6 +567,63 @@ static void writeLCDDBusByte_(uint8_t b) {
 #endif
 }
 
+#ifdef LCD_SHADOW_ENABLE
+/*
+  Returns the shadow cell for the given DDRAM address, or 0 if the address is not visible.
+ */
+static char* shadowCell(uint8_t addr) {
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+    if (addr >= lineBeginnings[row] && addr < lineBeginnings[row] + LCD_CHARACTERS_PER_LINE)
+      return shadow + row*LCD_CHARACTERS_PER_LINE + (addr - lineBeginnings[row]);
+  }
+  return 0;
+}
+
+/*
+  Track the effect of an instruction on the LCD address counter and DDRAM contents.
+ */
+static void shadowInstr(uint8_t instr) {
+  if (instr & INSTR_DDRAM_ADDR) {
+    shadowAddr = instr & ~INSTR_DDRAM_ADDR;
+  } else if (instr & INSTR_CGRAM_ADDR) {
+    shadowAddr = SHADOW_ADDR_CGRAM;
+  } else if (instr == CMD_CLEAR_DISPLAY) {
+    memset(shadow, ' ', LCD_CHARACTERS_PER_SCREEN);
+    shadowAddr = 0;
+    if (burst)
+      burstDirty = 0xff;
+  } else if ((instr & ~0x01) == CMD_RETURN_HOME) {
+    shadowAddr = 0;
+  }
+}
+
+/*
+  Track a data write at the LCD address counter, which then increments (wrapping as the LCD
+  does from the end of one DDRAM line to the beginning of the other).
+ */
+static void shadowData(char c) {
+  if (shadowAddr == SHADOW_ADDR_CGRAM)
+    return;
+
+  char* cell = shadowCell(shadowAddr);
+  if (cell) {
+    *cell = c;
+    if (burst)
+      burstDirty |= 1 << ((cell - shadow) / LCD_CHARACTERS_PER_LINE);
+  }
+
+#if LCD_NUMBER_OF_LINES == 1
+  if (++shadowAddr == 0x50)
+    shadowAddr = 0x00;
+#else
+  if (++shadowAddr == 0x28)
+    shadowAddr = 0x40;
+  else if (shadowAddr == 0x68)
+    shadowAddr = 0x00;
+#endif
+}
+#endif
+
 /*
   Given a 8 bit integer representing a LCD instruction, sends it to the LCD display.
 
@@ -178,10 +633,35 @@ static void writeLCDDBusByte_(uint8_t b) {
   needs to be handled by the caller.
 */
 static void writeLCDInstr_(uint8_t instr) {
+#ifdef LCD_SHADOW_ENABLE
+  if (burst) {
+    // DDRAM address, clear and home instructions are deferred to endLCDBurst; others (display
+    // control, CGRAM) go straight to the LCD
+    if ((instr & INSTR_DDRAM_ADDR) || (instr & ~0x03) == 0) {
+      shadowInstr(instr);
+      return;
+    }
+    burst = 0;
+    loop_until_LCD_BF_clear();
+    burst = 1;
+  }
+#endif
+
   LCD_RS_PORT &= ~(1 << LCD_RS); // RS=0
   LCD_RW_PORT &= ~(1 << LCD_RW); // RW=0
 
   writeLCDDBusByte_(instr);
+#ifdef LCD_SHADOW_ENABLE
+  shadowInstr(instr);
+#endif
+#ifdef LCD_WRITE_ONLY
+  if (instr == CMD_CLEAR_DISPLAY)
+    lcdPending = LCD_PENDING_CLEAR;
+  else if ((instr & ~0x01) == CMD_RETURN_HOME)
+    lcdPending = LCD_PENDING_HOME;
+  else
+    lcdPending = LCD_PENDING_SHORT;
+#endif
 }
 
 /*
@@ -200,12 +680,31 @@ static inline void writeLCDInstr(uint8_t instr) {
   data is written in two cycles using two successive calls to the writeLCDDBusNibble_ function.
 */
 static void writeCharToLCD_(char c) {
+#ifdef LCD_SHADOW_ENABLE
+  if (burst) {
+    if (shadowAddr != SHADOW_ADDR_CGRAM) {
+      shadowData(c);
+      return;
+    }
+    burst = 0;
+    loop_until_LCD_BF_clear();
+    burst = 1;
+  }
+#endif
+
   LCD_RS_PORT |= (1 << LCD_RS);  // RS=1
   LCD_RW_PORT &= ~(1 << LCD_RW); // RW=0
 
   writeLCDDBusByte_(c);
+#ifdef LCD_SHADOW_ENABLE
+  shadowData(c);
+#endif
+#ifdef LCD_WRITE_ONLY
+  lcdPending = LCD_PENDING_SHORT;
+#endif
 }
 
+#ifndef LCD_SHADOW_ENABLE
 static uint8_t readLCDDBusByte_(void) {
   LCD_RS_PORT |= (1 << LCD_RS); // RS=1
   LCD_RW_PORT |= (1 << LCD_RW); // RW=1
@@ -248,6 +747,264 @@ static uint8_t readLCDDBusByte_(void) {
 
   return c;
 }
+#endif
+
+/*
+  If the cursor has moved since the LCD address counter was last set, write the DDRAM address
+  of the cursor to the LCD. Consecutive cursor motions thus cost a single instruction.
+ */
+static void syncCursorAddr(void) {
+  if (cursorAddrStale) {
+    writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+    cursorAddrStale = 0;
+  }
+}
+
+/*
+  Write n characters from str to the LCD starting at the zero based physical line row and column
+  column without any wrap or scroll handling. The LCD address counter is left stale.
+ */
+static void writeCharsToLCD_(uint8_t row, uint8_t column, const char* str, uint8_t n) {
+  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[row] + column));
+  while (n--) {
+    loop_until_LCD_BF_clear(); // Wait until LCD is ready for new data
+    writeCharToLCD_(*(str++));
+  }
+
+  cursorAddrStale = 1;
+}
+
+/*
+  Scroll the physical lines top to bottom (zero based, inclusive) up by n lines. Only the lines
+  within the region are rewritten; new blank lines are added at the bottom of the region. The
+  cursor position is unaffected.
+ */
+static void scrollRegionUp(uint8_t top, uint8_t bottom, uint8_t n) {
+  uint8_t lines = bottom - top + 1;
+
+  if (n >= lines) {
+    lcdFill(top + 1, 1, (uint16_t) lines * LCD_CHARACTERS_PER_LINE, ' ');
+  } else {
+    uint8_t len = (lines - n)*LCD_CHARACTERS_PER_LINE + 1;
+    char str[len];
+    readCharsFromLCD(top + n + 1, 1, bottom + 1, LCD_CHARACTERS_PER_LINE, str, len);
+
+    for (uint8_t row = top, i = 0; row <= bottom - n; row++, i += LCD_CHARACTERS_PER_LINE)
+      writeCharsToLCD_(row, 0, str + i, LCD_CHARACTERS_PER_LINE);
+
+    // Add n newlines to bottom of region
+    lcdFill(bottom - n + 2, 1, (uint16_t) n * LCD_CHARACTERS_PER_LINE, ' ');
+  }
+}
+
+/*
+  Scroll the physical lines top to bottom (zero based, inclusive) down by n lines. Only the
+  lines within the region are rewritten; new blank lines are added at the top of the region.
+  The cursor position is unaffected.
+ */
+static void scrollRegionDown(uint8_t top, uint8_t bottom, uint8_t n) {
+  uint8_t lines = bottom - top + 1;
+
+  if (n >= lines) {
+    lcdFill(top + 1, 1, (uint16_t) lines * LCD_CHARACTERS_PER_LINE, ' ');
+  } else {
+    uint8_t len = (lines - n)*LCD_CHARACTERS_PER_LINE + 1;
+    char str[len];
+    readCharsFromLCD(top + 1, 1, bottom - n + 1, LCD_CHARACTERS_PER_LINE, str, len);
+
+    for (uint8_t row = top + n, i = 0; row <= bottom; row++, i += LCD_CHARACTERS_PER_LINE)
+      writeCharsToLCD_(row, 0, str + i, LCD_CHARACTERS_PER_LINE);
+
+    // Add n newlines to top of region
+    lcdFill(top + 1, 1, (uint16_t) n * LCD_CHARACTERS_PER_LINE, ' ');
+  }
+}
+
+#ifdef LCD_WIDGET_ENABLE
+/*
+  Write the rows of CGRAM character glyph that differ from the given ones. As in lcdUpdate, the
+  CGRAM address is only set again after a gap; the LCD address counter is left stale.
+ */
+static void writeGlyph(uint8_t glyph, const uint8_t* rows) {
+  uint8_t addrValid = 0;
+
+  for (uint8_t r = 0; r < 8; r++) {
+    if (glyphs[glyph][r] == rows[r]) {
+      addrValid = 0;
+      continue;
+    }
+
+    if (!addrValid) {
+      writeLCDInstr(INSTR_CGRAM_ADDR | (glyph << 3) | r);
+      addrValid = 1;
+      cursorAddrStale = 1;
+    }
+    loop_until_LCD_BF_clear(); // Wait until LCD is ready for new data
+    writeCharToLCD_(rows[r]);
+    glyphs[glyph][r] = rows[r];
+  }
+}
+
+/*
+  Returns the CGRAM characters used by the widget w, one bit each.
+ */
+static uint8_t widgetGlyphs(const lcdWidget* w) {
+  uint8_t count = w->type == LCD_WIDGET_SPARKLINE ? w->length : 1;
+  return ((1 << count) - 1) << w->glyph;
+}
+
+/*
+  Bring the glyph and cells of the bar w up to date with its value. The partial cell at the end
+  of the bar shows its glyph; only the rows of the glyph that change are written (for a
+  vertical bar, those between the old and new level).
+ */
+static void drawBar(const lcdWidget* w) {
+  uint8_t pixels = w->type == LCD_WIDGET_HBAR ? 5 : 8; // per cell, along the bar
+  uint16_t level = ((uint16_t) w->value * w->length * pixels + 127) / 255;
+  uint8_t full = level / pixels;
+  uint8_t part = level % pixels;
+
+  if (part) {
+    uint8_t rows[8];
+    for (uint8_t r = 0; r < 8; r++) {
+      if (w->type == LCD_WIDGET_HBAR)
+        rows[r] = (0x1f << (5 - part)) & 0x1f; // part columns from the left
+      else
+        rows[r] = r >= 8 - part ? 0x1f : 0;   // part rows from the bottom
+    }
+    writeGlyph(w->glyph, rows);
+  }
+
+  for (uint8_t i = 0; i < w->length; i++) {
+    char c = i < full ? WIDGET_FULL : (i == full && part) ? WIDGET_CHAR(w->glyph) : ' ';
+    if (w->type == LCD_WIDGET_HBAR)
+      lcdUpdate(w->row + 1, w->column + i + 1, &c, 1);
+    else
+      lcdUpdate(w->row - i + 1, w->column + 1, &c, 1);
+  }
+}
+
+/*
+  Add a sample to the sparkline w: each glyph row moves left by one pixel column, taking the
+  leftmost column of the next cell, and the sample enters at the right as a column of lit rows.
+ */
+static void pushSparkline(const lcdWidget* w) {
+  uint8_t lit = ((uint16_t) w->value * 8 + 127) / 255;
+  uint8_t rows[8];
+
+  for (uint8_t i = 0; i < w->length; i++) {
+    uint8_t glyph = w->glyph + i;
+    for (uint8_t r = 0; r < 8; r++) {
+      uint8_t in = i + 1 < w->length ? (glyphs[glyph + 1][r] >> 4) & 1 : r >= 8 - lit;
+      rows[r] = ((glyphs[glyph][r] << 1) & 0x1f) | in;
+    }
+    writeGlyph(glyph, rows);
+  }
+}
+
+/*
+  Write the cells of the sparkline w (which show its glyphs in order).
+ */
+static void drawSparkline(const lcdWidget* w) {
+  char cells[LCD_CHARACTERS_PER_LINE];
+  for (uint8_t i = 0; i < w->length; i++)
+    cells[i] = WIDGET_CHAR(w->glyph + i);
+  lcdUpdate(w->row + 1, w->column + 1, cells, w->length);
+}
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+static uint8_t* checkpointAddr(uint8_t slot) {
+  return (uint8_t*) (uintptr_t) (LCD_CHECKPOINT_EEPROM_START + (uint16_t) slot*CHECKPOINT_SLOT);
+}
+
+/*
+  Returns the CRC a checkpoint starts from; including the geometry rejects checkpoints written
+  for another display.
+ */
+static uint16_t checkpointCrcInit(void) {
+  return _crc_ccitt_update(_crc_ccitt_update(0xffff, LCD_NUMBER_OF_LINES), LCD_CHARACTERS_PER_LINE);
+}
+
+static uint8_t checkpointValid(uint8_t slot) {
+  uint8_t* addr = checkpointAddr(slot);
+  uint16_t crc = checkpointCrcInit();
+
+  for (uint16_t i = 0; i < CHECKPOINT_SLOT; i++)
+    crc = _crc_ccitt_update(crc, eeprom_read_byte(addr + i));
+  return crc == 0;
+}
+
+/*
+  Find the newest valid checkpoint: the one whose following slot is invalid or holds an older
+  checkpoint (slots are written in turn with increasing sequence numbers).
+ */
+static void findCheckpoint(void) {
+  checkpointSlot = CHECKPOINT_SLOTS;
+
+  for (uint8_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+    if (!checkpointValid(slot))
+      continue;
+
+    uint8_t next = (slot + 1) % CHECKPOINT_SLOTS;
+    uint8_t seq = eeprom_read_byte(checkpointAddr(slot));
+    if (!checkpointValid(next) || eeprom_read_byte(checkpointAddr(next)) != (uint8_t) (seq + 1)) {
+      checkpointSlot = slot;
+      checkpointSeq = seq;
+      return;
+    }
+  }
+}
+
+/*
+  Returns byte i of the checkpoint being written.
+ */
+static uint8_t checkpointByte(uint16_t i) {
+  if (i < CHECKPOINT_HEADER)
+    return checkpointHeader[i];
+  if (i < CHECKPOINT_HEADER + LCD_CHARACTERS_PER_SCREEN)
+    return shadow[i - CHECKPOINT_HEADER];
+  return i == CHECKPOINT_SLOT - 2 ? checkpointCrc & 0xff : checkpointCrc >> 8;
+}
+
+/*
+  Restore the screen, cursor and display state from the newest checkpoint, if any.
+ */
+static void restoreCheckpoint(void) {
+  findCheckpoint();
+  if (checkpointSlot == CHECKPOINT_SLOTS)
+    return;
+
+  uint8_t* addr = checkpointAddr(checkpointSlot);
+  for (uint8_t i = 0; i < LCD_CHARACTERS_PER_SCREEN; i++)
+    shadow[i] = eeprom_read_byte(addr + CHECKPOINT_HEADER + i);
+
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++)
+    writeCharsToLCD_(row, 0, shadow + row*LCD_CHARACTERS_PER_LINE, LCD_CHARACTERS_PER_LINE);
+
+  uint8_t row = eeprom_read_byte(addr + 1), column = eeprom_read_byte(addr + 2);
+  if (row < LCD_NUMBER_OF_LINES && column < LCD_CHARACTERS_PER_LINE) {
+    currentLineNum = row;
+    currentLineChars = column;
+  }
+
+  lcdState = eeprom_read_byte(addr + 3) & ((1 << INSTR_DISPLAY_D) | (1 << INSTR_DISPLAY_C) | (1 << INSTR_DISPLAY_B));
+  writeLCDInstr(INSTR_DISPLAY | lcdState);
+  syncCursorAddr();
+}
+#endif
+
+/*
+  Move the cursor to the next line; when on the bottom line of the scrolling region, scroll the
+  region up instead. On the last line of the screen (outside the region) the cursor stays put.
+ */
+static void lineFeed(void) {
+  if (currentLineNum == scrollBottom) {
+    scrollUp(1);
+  } else if (currentLineNum < LCD_NUMBER_OF_LINES - 1) {
+    currentLineNum++;
+  }
+}
 
 /*
   Given a character string, and a uint8_t pointer, reads the character string until a
@@ -280,46 +1037,34 @@ static uint8_t readASCIINumber(char* str, uint8_t* found_num, char** new_loc) {
 }
 
 /*
-  Set all pins of LCD_DBUS as outputs
-*/
-static inline void setLCDDBusAsOutputs(void) {
-#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
-  LCD_DBUS7_DDR |= (1 << LCD_DBUS7);
-  LCD_DBUS6_DDR |= (1 << LCD_DBUS6);
-  LCD_DBUS5_DDR |= (1 << LCD_DBUS5);
-  LCD_DBUS4_DDR |= (1 << LCD_DBUS4);
-#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
-  LCD_DBUS3_DDR |= (1 << LCD_DBUS3);
-  LCD_DBUS2_DDR |= (1 << LCD_DBUS2);
-  LCD_DBUS1_DDR |= (1 << LCD_DBUS1);
-  LCD_DBUS0_DDR |= (1 << LCD_DBUS0);
-#endif
-#else
-  LCD_DBUS_DDR = 0xff;
-#endif
-}
-
-/*
-  Set all pins of LCD_DBUS as inputs (disabling their output)
-*/
-static inline void setLCDDBusAsInputs(void) {
-#if defined (FOUR_BIT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE)
-  LCD_DBUS7_DDR &= ~(1 << LCD_DBUS7);
-  LCD_DBUS6_DDR &= ~(1 << LCD_DBUS6);
-  LCD_DBUS5_DDR &= ~(1 << LCD_DBUS5);
-  LCD_DBUS4_DDR &= ~(1 << LCD_DBUS4);
-#ifdef EIGHT_BIT_ARBITRARY_PIN_MODE
-  LCD_DBUS3_DDR &= ~(1 << LCD_DBUS3);
-  LCD_DBUS2_DDR &= ~(1 << LCD_DBUS2);
-  LCD_DBUS1_DDR &= ~(1 << LCD_DBUS1);
-  LCD_DBUS0_DDR &= ~(1 << LCD_DBUS0);
-#endif
-#else
-  LCD_DBUS_DDR = 0;
-#endif
-}
-
-/*
+  Given a character string and a uint8_t, writes the decimal ASCII representation of the number
+  to the string (without null termination), returning the position following the last digit.
+ */
+static char* writeASCIINumber(char* str, uint8_t n) {
+  if (n >= 100) *(str++) = '0' + n / 100;
+  if (n >= 10)  *(str++) = '0' + (n / 10) % 10;
+  *(str++) = '0' + n % 10;
+  return str;
+}
+
+/*
+  Answer a DSR (device status report) request with a CPR (cursor position report) of the form
+  ESC[row;columnR using the registered response handler.
+ */
+static void reportCursorPosition(void) {
+  if (responseHandler) {
+    char str[11] = "\e[";
+    char* end = writeASCIINumber(str + 2, currentLineNum + 1);
+    *(end++) = ';';
+    end = writeASCIINumber(end, currentLineChars + 1);
+    *(end++) = 'R';
+    *end = '\0';
+
+    responseHandler(str);
+  }
+}
+
+/*
   Set RS=RW=0 and write the CMD_INIT command to the LCD data bus. Note that an appropriate
   pause must follow before sending new commands to the LCD using writeLCD*_ functions.
  */
@@ -334,14 +1079,11 @@ static inline void softwareLCDInitPulse(void) {
 #endif
 }
 
-
-//---------------------------------------------------------------------------------------------
-// Library function definitions
-
 /*
-  Do software initialization as specified by the datasheet
-*/
-void initLCD(void) {
+  Run the software initialization specified by the datasheet up to (and including) the entry
+  mode; the display is left off, and is only cleared if clear is non-zero.
+ */
+static void initLCDController(uint8_t clear) {
   // Set LCD_RS, LCD_RW and LCD_ENABLE as outputs
   LCD_RS_DDR |= (1 << LCD_RS);
   LCD_RW_DDR |= (1 << LCD_RW);
@@ -349,16 +1091,40 @@ void initLCD(void) {
 
   setLCDDBusAsOutputs();
 
-  _delay_us(LCD_INIT_DELAY0); // Wait minimum 15ms as per datasheet
+#ifdef PCF8574_MODE
+  flushExpander();            // When re-initializing, let the transaction in progress end first
+  TWSR = 0;
+  TWBR = EXPANDER_TWBR;
+  TWCR = (1 << TWEN);
+#ifdef LCD_PCF8574_BACKLIGHT
+  lcdExpander |= (1 << LCD_PCF8574_BACKLIGHT);
+#endif
+#endif
+
+#ifdef HC595_MODE
+  LCD_HC595_SPI_DDR |= (1 << LCD_HC595_MOSI) | (1 << LCD_HC595_SCK);
+  LCD_HC595_LATCH_DDR |= (1 << LCD_HC595_LATCH);
+  SPCR = (1 << SPE) | (1 << MSTR);          // Master, mode 0, MSB first
+  SPSR = (1 << SPI2X);                      // F_CPU/2
+#ifdef LCD_HC595_BACKLIGHT
+  lcdShiftRegister |= (1 << LCD_HC595_BACKLIGHT);
+#endif
+  shiftRegisterLast = ~lcdShiftRegister;    // The outputs are unknown after a reset
+  latchShiftRegister();
+#endif
+
+  lcdDelayUs(LCD_INIT_DELAY0); // Wait minimum 15ms as per datasheet
   softwareLCDInitPulse();
-  _delay_us(LCD_INIT_DELAY1); // Wait minimum 4.1ms as per datasheet
+  lcdDelayUs(LCD_INIT_DELAY1); // Wait minimum 4.1ms as per datasheet
   softwareLCDInitPulse();
-  _delay_us(LCD_INIT_DELAY2); // Wait minimum 100us as per datasheet
+  lcdDelayUs(LCD_INIT_DELAY2); // Wait minimum 100us as per datasheet
   softwareLCDInitPulse();
+  lcdDelayUs(LCD_GENERIC_INSTR_DELAY); // BF can't be checked yet
 
 #if defined (FOUR_BIT_MODE)
   // Function Set (4-bit interface)
   writeLCDDBusNibble_(CMD_INIT_FOUR_BIT);
+  lcdDelayUs(LCD_GENERIC_INSTR_DELAY);
   writeLCDInstr_(CMD_INIT_FOUR_BIT | LCD_LINES | LCD_FONT);
 #else
   // Function set (8-bit interface)
@@ -371,16 +1137,101 @@ void initLCD(void) {
   writeLCDInstr(INSTR_DISPLAY); // Display off
 
   // Clear display
-  writeLCDInstr(CMD_CLEAR_DISPLAY);
+  if (clear)
+    writeLCDInstr(CMD_CLEAR_DISPLAY);
 
   // Increment mode, no shift
   writeLCDInstr(INSTR_ENTRY_SET | (1 << INSTR_ENTRY_SET_ID));
+}
+
+
+//---------------------------------------------------------------------------------------------
+// Library function definitions
+
+/*
+  Do software initialization as specified by the datasheet
+*/
+void initLCD(void) {
+  initLCDController(1);
 
   // Display on, cursor on, blink off
   lcdState = (1 << INSTR_DISPLAY_D) | (1 << INSTR_DISPLAY_C);
   writeLCDInstr(INSTR_DISPLAY | lcdState);
+
+  currentLineNum   = 0;
+  currentLineChars = 0;
+  cursorAddrStale  = 0;
+
+  scrollTop    = 0;
+  scrollBottom = LCD_NUMBER_OF_LINES - 1;
+
+#ifdef LCD_WIDGET_ENABLE
+  memset(glyphs, 0xff, sizeof(glyphs)); // CGRAM is undefined after power on
+  memset(widgets, 0, sizeof(widgets));
+  glyphsUsed = 0;
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+  restoreCheckpoint();
+#endif
+}
+
+#ifdef LCD_BF_TIMEOUT
+uint8_t recoverLCD(void) {
+  recovering = 1;
+  lcdFault = 0;
+
+  uint8_t stale = cursorAddrStale;
+#ifdef LCD_SHADOW_ENABLE
+  uint8_t addr = shadowAddr;
+  uint8_t savedBurst = burst;
+  burst = 0;
+
+  // DDRAM survives most glitches but not a brown-out; repaint it from the shadow rather than
+  // clearing it, then put the address counter back where the interrupted write expects it
+  initLCDController(0);
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++)
+    writeCharsToLCD_(row, 0, shadow + row*LCD_CHARACTERS_PER_LINE, LCD_CHARACTERS_PER_LINE);
+#ifdef LCD_WIDGET_ENABLE
+  // CGRAM is lost along with DDRAM; rewrite the glyphs of the widgets
+  for (uint8_t glyph = 0; glyph < 8; glyph++) {
+    if (glyphsUsed & (1 << glyph)) {
+      uint8_t rows[8];
+      memcpy(rows, glyphs[glyph], sizeof(rows));
+      memset(glyphs[glyph], 0xff, sizeof(rows));
+      writeGlyph(glyph, rows);
+    }
+  }
+#endif
+
+  if (addr == SHADOW_ADDR_CGRAM) {
+    addr = lineBeginnings[currentLineNum] + currentLineChars;
+    stale = 0;
+  }
+  writeLCDInstr(INSTR_DDRAM_ADDR | addr);
+  burst = savedBurst;
+#else
+  // Without the shadow the screen contents are lost
+  initLCDController(1);
+  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  stale = 0;
+#endif
+  writeLCDInstr(INSTR_DISPLAY | lcdState);
+  cursorAddrStale = stale;
+
+  recovering = 0;
+  return !lcdFault;
+}
+
+uint8_t isLCDFaulted(void) {
+  return lcdFault;
 }
 
+uint16_t getLCDFaultCount(void) {
+  return lcdFaultCount;
+}
+#endif
+
 /*
   Given a single character, checks whether its a ASCII escape and does the following:
 
@@ -400,15 +1251,10 @@ void initLCD(void) {
 void writeCharToLCD(char c) {
   switch (c) {
   case '\n': // Line feed
-    if (currentLineNum == LCD_NUMBER_OF_LINES - 1) {
-      scrollUp(1);
+    lineFeed();
 
-      currentLineChars = 0;
-      writeLCDInstr(INSTR_DDRAM_ADDR | lineBeginnings[currentLineNum]);
-    } else {
-      currentLineChars = 0;
-      writeLCDInstr(INSTR_DDRAM_ADDR | lineBeginnings[++currentLineNum]);
-    }
+    currentLineChars = 0;
+    cursorAddrStale = 1;
     break;
   case '\a': // Alarm
     break;
@@ -419,43 +1265,83 @@ void writeCharToLCD(char c) {
     } else if (currentLineChars == 0) {
       // At beginning of line, need to move the end of previous line
       currentLineChars = LCD_CHARACTERS_PER_LINE - 1;
-      writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[--currentLineNum] + currentLineChars));
+      currentLineNum--;
     } else {
       // OK, simply go back one character
-      writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + --currentLineChars));
+      currentLineChars--;
     }
 
+    cursorAddrStale = 1;
     break;
   case '\r': // Carriage return
-    writeLCDInstr(INSTR_DDRAM_ADDR | lineBeginnings[currentLineNum]);
     currentLineChars = 0;
+    cursorAddrStale = 1;
     break;
   case '\f': // Form feed
     clearDisplay();
     break;
   default:   // Printable character
-    if (currentLineChars == LCD_CHARACTERS_PER_LINE - 1 && currentLineNum == LCD_NUMBER_OF_LINES - 1) {
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      writeCharToLCD_(c);
-
-      scrollUp(1);
+    syncCursorAddr();
+    loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
+    writeCharToLCD_(c);
 
-      currentLineChars = 0;
-      writeLCDInstr(INSTR_DDRAM_ADDR | lineBeginnings[currentLineNum]);
-    } else if (currentLineChars == LCD_CHARACTERS_PER_LINE - 1) {
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      writeCharToLCD_(c);
+    if (currentLineChars == LCD_CHARACTERS_PER_LINE - 1) {
+      // The LCD address counter does not follow the physical line order; wrap explicitly
+      lineFeed();
 
       currentLineChars = 0;
-      writeLCDInstr(INSTR_DDRAM_ADDR | lineBeginnings[++currentLineNum]);
+      cursorAddrStale = 1;
     } else {
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      writeCharToLCD_(c);
       currentLineChars++;
     }
   }
 }
 
+void setLCDResponseHandler(void (*handler)(const char*)) {
+  responseHandler = handler;
+}
+
+/*
+  Put function of the LCD stream (see openLCDStream).
+ */
+static int putLCDStream(char c, FILE* stream) {
+#ifdef LCD_ANSI_ESCAPE_ENABLE
+  if (streamEscapeLength) {
+    streamEscape[streamEscapeLength++] = c;
+
+    // The sequence ends with the byte after ESC unless it starts a CSI, then with a final byte,
+    // any other byte that can't be part of it or once the buffer is full
+    if (streamEscapeLength == 2 ? c != '[' :
+        c < 0x20 || c >= 0x40 || streamEscapeLength == sizeof(streamEscape) - 1) {
+      streamEscape[streamEscapeLength] = '\0';
+      streamEscapeLength = 0;
+      writeStringToLCD(streamEscape);
+    }
+    return 0;
+  }
+
+  if (c == '\e') {
+    streamEscape[0] = c;
+    streamEscapeLength = 1;
+    return 0;
+  }
+#endif
+
+  writeCharToLCD(c);
+  return 0;
+}
+
+FILE* openLCDStream(void) {
+  static FILE file;
+  static FILE* stream;
+
+  if (!stream) {
+    stream = &file;
+    fdev_setup_stream(stream, putLCDStream, NULL, _FDEV_SETUP_WRITE);
+  }
+  return stream;
+}
+
 void writeStringToLCD(char* str) {
   while (*str != '\0') {
 #ifdef LCD_ANSI_ESCAPE_ENABLE
@@ -485,6 +1371,37 @@ void writeStringToLCD(char* str) {
             } // Invalid escape
           } // Invalid escape
           return;
+#ifdef LCD_WIDGET_ENABLE
+        case '=': // Private; widgets (see defineLCDWidget)
+          {
+            uint8_t fnd0, fnd1 = 0;
+            uint8_t num0 = readASCIINumber(++str_ref, &fnd0, &str_ref);
+            uint8_t num1 = 0;
+            if (*str_ref == ';')
+              num1 = readASCIINumber(++str_ref, &fnd1, &str_ref);
+
+            if (fnd0 && fnd1) {
+              uint8_t row = currentLineNum + 1, column = currentLineChars + 1;
+              switch (*str_ref) {
+              case 'b': // Horizontal bar at the cursor
+                defineLCDWidget(num0, LCD_WIDGET_HBAR, row, column, num1);
+                break;
+              case 'c': // Vertical bar up from the cursor
+                defineLCDWidget(num0, LCD_WIDGET_VBAR, row, column, num1);
+                break;
+              case 's': // Sparkline at the cursor
+                defineLCDWidget(num0, LCD_WIDGET_SPARKLINE, row, column, num1);
+                break;
+              case 'v': // Value
+                setLCDWidget(num0, num1);
+                break;
+              default:  // Invalid control character
+                break;
+              }
+            } // Invalid escape
+          }
+          return;
+#endif
         default:
           break;
         }
@@ -508,6 +1425,11 @@ void writeStringToLCD(char* str) {
             num1 = fnd1 ? num1 : 1;
             setCursorPosition(num0, num1);
             break;
+          case 'r': // DECSTBM - Set top and bottom margins
+            num0 = fnd0 ? num0 : 1;
+            num1 = fnd1 ? num1 : LCD_NUMBER_OF_LINES;
+            setScrollRegion(num0, num1);
+            break;
           default: // Invalid control character
             break;
           }
@@ -542,6 +1464,11 @@ void writeStringToLCD(char* str) {
             num0 = fnd0 ? num0 : 1;
             moveCursorToColumn(num0);
             break;
+          case 'f': // HVP - Horizontal and vertical position (column defaults to 1)
+          case 'H': // CUP - Cursor position (column defaults to 1)
+            num0 = fnd0 ? num0 : 1;
+            setCursorPosition(num0, 1);
+            break;
           case 'J': // ED - Erase display
             num0 = fnd0 ? num0 : 1;
             eraseDisplay(num0);
@@ -558,6 +1485,30 @@ void writeStringToLCD(char* str) {
             num0 = fnd0 ? num0 : 1;
             scrollDown(num0);
             break;
+          case '@': // ICH - Insert characters
+            num0 = fnd0 ? num0 : 1;
+            insertChars(num0);
+            break;
+          case 'P': // DCH - Delete characters
+            num0 = fnd0 ? num0 : 1;
+            deleteChars(num0);
+            break;
+          case 'X': // ECH - Erase characters
+            num0 = fnd0 ? num0 : 1;
+            eraseChars(num0);
+            break;
+          case 'L': // IL - Insert lines
+            num0 = fnd0 ? num0 : 1;
+            insertLines(num0);
+            break;
+          case 'M': // DL - Delete lines
+            num0 = fnd0 ? num0 : 1;
+            deleteLines(num0);
+            break;
+          case 'r': // DECSTBM - Set top margin (bottom margin defaults to the last line)
+            num0 = fnd0 ? num0 : 1;
+            setScrollRegion(num0, LCD_NUMBER_OF_LINES);
+            break;
           case 'm': // SGR - Select graphic rendition (single optional argument)
             break;
           case ';': // SGR - Select graphic rendition (multiple arguments)
@@ -582,7 +1533,8 @@ void writeStringToLCD(char* str) {
             break;
           case 'n': // DSR - Device status report
             if (fnd0 && num0 == 6) {
-              // Valid DSR
+              // Valid DSR; report the cursor position
+              reportCursorPosition();
             } else {
               // Invalid DSR
             }
@@ -619,6 +1571,7 @@ void clearDisplay(void) {
   // Reset line and char number tracking
   currentLineNum   = 0;
   currentLineChars = 0;
+  cursorAddrStale  = 0;
 }
 
 /*
@@ -631,6 +1584,7 @@ void returnHome(void) {
   // Reset line and char number tracking
   currentLineNum   = 0;
   currentLineChars = 0;
+  cursorAddrStale  = 0;
 }
 
 void getCursorPosition(uint8_t* row, uint8_t* column) {
@@ -643,7 +1597,7 @@ void setCursorPosition(uint8_t row, uint8_t column) {
   currentLineNum = row ? row - 1 : 0;
   currentLineChars = column ? column - 1 : 0;
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorUp(uint8_t n) {
@@ -653,7 +1607,7 @@ void moveCursorUp(uint8_t n) {
     currentLineNum = 0;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorDown(uint8_t n) {
@@ -663,7 +1617,7 @@ void moveCursorDown(uint8_t n) {
     currentLineNum = LCD_NUMBER_OF_LINES - 1;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorForward(uint8_t n) {
@@ -673,7 +1627,7 @@ void moveCursorForward(uint8_t n) {
     currentLineChars = LCD_CHARACTERS_PER_LINE - 1;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorBackward(uint8_t n) {
@@ -683,7 +1637,7 @@ void moveCursorBackward(uint8_t n) {
     currentLineChars = 0;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorNextLine(uint8_t n) {
@@ -695,7 +1649,7 @@ void moveCursorNextLine(uint8_t n) {
     currentLineNum = LCD_NUMBER_OF_LINES - 1;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorPreviousLine(uint8_t n) {
@@ -707,140 +1661,149 @@ void moveCursorPreviousLine(uint8_t n) {
     currentLineNum = 0;
   }
 
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void moveCursorToColumn(uint8_t n) {
   if (n <= LCD_CHARACTERS_PER_LINE) {
     currentLineChars = n ? n - 1 : 0;
-    writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+    cursorAddrStale = 1;
   } // else index out of range (off screen column)
 }
 
 void eraseDisplay(uint8_t n) {
-  uint8_t old_row, old_column;
-  getCursorPosition(&old_row, &old_column);
-
   switch (n) {
   case 0: // Clear from cursor to end of screen
-    {
-      uint8_t len = (LCD_NUMBER_OF_LINES - old_row)*LCD_CHARACTERS_PER_LINE + (LCD_CHARACTERS_PER_LINE - old_column);
-      for (uint8_t i = 0; i < len; i++)
-        writeCharToLCD(' ');
-
-      // Write last char without scrolling
-      loop_until_LCD_BF_clear();
-      writeCharToLCD_(' ');
-      break;
-    }
+    lcdFill(currentLineNum + 1, currentLineChars + 1,
+            (uint16_t) (LCD_NUMBER_OF_LINES - currentLineNum) * LCD_CHARACTERS_PER_LINE - currentLineChars, ' ');
+    break;
   case 1: // Clear from cursor to beginning of screen
+    lcdFill(1, 1, (uint16_t) currentLineNum * LCD_CHARACTERS_PER_LINE + currentLineChars + 1, ' ');
+    break;
+  case 2: // Clear entire screen
     {
-      uint8_t len = (old_row - 1)*LCD_CHARACTERS_PER_LINE + old_column;
-      returnHome();
-      for (uint8_t i = 0; i < len; i++)
-        writeCharToLCD(' ');
-
-      // Write last char without scrolling
-      loop_until_LCD_BF_clear();
-      writeCharToLCD_(' ');
+      uint8_t old_row, old_column;
+      getCursorPosition(&old_row, &old_column);
+
+      clearDisplay();
+      setCursorPosition(old_row, old_column);
       break;
     }
-  case 2: // Clear entire screen
-    clearDisplay();
-    break;
   default: // Invalid argument; do nothing
     break;
   }
-
-  setCursorPosition(old_row, old_column);
 }
 
 void eraseInline(uint8_t n) {
-  uint8_t old_row, old_column;
-  getCursorPosition(&old_row, &old_column);
-
   switch (n) {
   case 0: // Clear from cursor to end of line
-    for (uint8_t i = old_column; i <= LCD_CHARACTERS_PER_LINE; i++)
-      writeCharToLCD(' ');
+    lcdFill(currentLineNum + 1, currentLineChars + 1, LCD_CHARACTERS_PER_LINE - currentLineChars, ' ');
     break;
   case 1: // Clear from cursor to beginning of line
-    setCursorPosition(old_row, 1);
-    for (uint8_t i = 1; i <= old_column; i++)
-      writeCharToLCD(' ');
+    lcdFill(currentLineNum + 1, 1, currentLineChars + 1, ' ');
     break;
   case 2: // Clear entire line
-    setCursorPosition(old_row, 1);
-    for (uint8_t i = 1; i <= LCD_CHARACTERS_PER_LINE; i++) {
-      loop_until_LCD_BF_clear();
-      writeCharToLCD_(' ');
-    }
+    lcdFill(currentLineNum + 1, 1, LCD_CHARACTERS_PER_LINE, ' ');
     break;
   default: // Invalid argument; do nothing
-    return;
+    break;
   }
-
-  setCursorPosition(old_row, old_column);
 }
 
 void scrollUp(uint8_t n) {
-#if LCD_NUMBER_OF_LINES == 1
-  clearDisplay();
-#else
-  if (n >= LCD_NUMBER_OF_LINES) {
-    clearDisplay();
-  } else {
-    uint8_t old_row, old_column;
-    getCursorPosition(&old_row, &old_column);
-
-    uint8_t len = (LCD_NUMBER_OF_LINES - n)*LCD_CHARACTERS_PER_LINE + 1;
-    char str[len];
-    readCharsFromLCD(n + 1, 1, LCD_NUMBER_OF_LINES, LCD_CHARACTERS_PER_LINE, str, len);
-    setCursorPosition(1, 1); // returnHome();
-    writeStringToLCD(str);
-
-    // Add n newlines to bottom of screen
-    for (uint8_t i = 0; i < n; i++) {
-      setCursorPosition(LCD_NUMBER_OF_LINES - i, 1);
-      eraseInline(2);
-    }
+  PROFILE_BEGIN(PROFILE_SCROLL_UP);
 
-    setCursorPosition(old_row, old_column);
+  if (n >= LCD_NUMBER_OF_LINES && scrollTop == 0 && scrollBottom == LCD_NUMBER_OF_LINES - 1) {
+    clearDisplay();
+  } else if (n > 0) {
+    scrollRegionUp(scrollTop, scrollBottom, n);
   }
-#endif
+
+  PROFILE_END(PROFILE_SCROLL_UP);
 }
 
 void scrollDown(uint8_t n) {
-#if LCD_NUMBER_OF_LINES == 1
-  clearDisplay();
-#else
-  if (n >= LCD_NUMBER_OF_LINES) {
+  PROFILE_BEGIN(PROFILE_SCROLL_DOWN);
+
+  if (n >= LCD_NUMBER_OF_LINES && scrollTop == 0 && scrollBottom == LCD_NUMBER_OF_LINES - 1) {
     clearDisplay();
-  } else {
-    uint8_t old_row, old_column;
-    getCursorPosition(&old_row, &old_column);
+  } else if (n > 0) {
+    scrollRegionDown(scrollTop, scrollBottom, n);
+  }
 
-    uint8_t len = (LCD_NUMBER_OF_LINES - n)*LCD_CHARACTERS_PER_LINE + 1;
-    char str[len];
-    readCharsFromLCD(1, 1, LCD_NUMBER_OF_LINES - n, LCD_CHARACTERS_PER_LINE, str, len);
+  PROFILE_END(PROFILE_SCROLL_DOWN);
+}
 
-    for (uint8_t column = n + 1, i = 0; column <= LCD_NUMBER_OF_LINES; column++) {
-      setCursorPosition(column , 1);
-      for (uint8_t row = 1; row <= LCD_CHARACTERS_PER_LINE; row++) {
-        loop_until_LCD_BF_clear();
-        writeCharToLCD_(str[i++]);
-      }
-    }
+void setScrollRegion(uint8_t top, uint8_t bottom) {
+  top = top ? top - 1 : 0;
+  bottom = (bottom && bottom <= LCD_NUMBER_OF_LINES) ? bottom - 1 : LCD_NUMBER_OF_LINES - 1;
 
-    // Add n newlines to top of screen
-    for (uint8_t i = 1; i <= n; i++) {
-      setCursorPosition(i, 1);
-      eraseInline(2);
-    }
+  if (top < bottom) {
+    scrollTop = top;
+    scrollBottom = bottom;
+
+    // As with DECSTBM, the cursor is moved to the home position
+    setCursorPosition(1, 1);
+  } // else invalid region; do nothing
+}
 
-    setCursorPosition(old_row, old_column);
+void insertLines(uint8_t n) {
+  // Only has an effect when the cursor is within the scrolling region
+  if (currentLineNum >= scrollTop && currentLineNum <= scrollBottom) {
+    scrollRegionDown(currentLineNum, scrollBottom, n ? n : 1);
+    currentLineChars = 0;
+    cursorAddrStale = 1;
   }
-#endif
+}
+
+void deleteLines(uint8_t n) {
+  // Only has an effect when the cursor is within the scrolling region
+  if (currentLineNum >= scrollTop && currentLineNum <= scrollBottom) {
+    scrollRegionUp(currentLineNum, scrollBottom, n ? n : 1);
+    currentLineChars = 0;
+    cursorAddrStale = 1;
+  }
+}
+
+void insertChars(uint8_t n) {
+  uint8_t remaining = LCD_CHARACTERS_PER_LINE - currentLineChars;
+  n = n ? n : 1;
+
+  if (n < remaining) {
+    // Shift the cells from the cursor right by n; cells pushed past the end of line are lost
+    uint8_t len = remaining - n;
+    char str[len + 1];
+    readCharsFromLCD(currentLineNum + 1, currentLineChars + 1, currentLineNum + 1, LCD_CHARACTERS_PER_LINE - n, str, len + 1);
+    writeCharsToLCD_(currentLineNum, currentLineChars + n, str, len);
+  } else {
+    n = remaining;
+  }
+
+  lcdFill(currentLineNum + 1, currentLineChars + 1, n, ' ');
+}
+
+void deleteChars(uint8_t n) {
+  uint8_t remaining = LCD_CHARACTERS_PER_LINE - currentLineChars;
+  n = n ? n : 1;
+
+  if (n < remaining) {
+    // Shift the cells after the deleted ones left by n
+    uint8_t len = remaining - n;
+    char str[len + 1];
+    readCharsFromLCD(currentLineNum + 1, currentLineChars + n + 1, currentLineNum + 1, LCD_CHARACTERS_PER_LINE, str, len + 1);
+    writeCharsToLCD_(currentLineNum, currentLineChars, str, len);
+  } else {
+    n = remaining;
+  }
+
+  lcdFill(currentLineNum + 1, LCD_CHARACTERS_PER_LINE - n + 1, n, ' ');
+}
+
+void eraseChars(uint8_t n) {
+  uint8_t remaining = LCD_CHARACTERS_PER_LINE - currentLineChars;
+  n = n ? n : 1;
+
+  lcdFill(currentLineNum + 1, currentLineChars + 1, n < remaining ? n : remaining, ' ');
 }
 
 void saveCursorPosition() {
@@ -851,7 +1814,7 @@ void saveCursorPosition() {
 void restoreCursorPosition() {
   currentLineNum = saveCursorLineNum;
   currentLineChars = saveCursorLineChars;
-  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[currentLineNum] + currentLineChars));
+  cursorAddrStale = 1;
 }
 
 void hideCursor(void) {
@@ -860,6 +1823,7 @@ void hideCursor(void) {
 }
 
 void showCursor(void) {
+  syncCursorAddr();
   lcdState |= (1 << INSTR_DISPLAY_C);
   writeLCDInstr(INSTR_DISPLAY | lcdState);
 }
@@ -867,12 +1831,19 @@ void showCursor(void) {
 //-----------------------------------------------------------------------------------------------
 // Utility functions (with no associated ASCII or ANSI escape)
 
+void flushCursorPosition(void) {
+  // The address counter only matters to the user while the cursor is visible
+  if (lcdState & ((1 << INSTR_DISPLAY_C) | (1 << INSTR_DISPLAY_B)))
+    syncCursorAddr();
+}
+
 void blinkCursorOff(void) {
   lcdState &= ~(1 << INSTR_DISPLAY_B);
   writeLCDInstr(INSTR_DISPLAY | lcdState);
 }
 
 void blinkCursorOn(void) {
+  syncCursorAddr();
   lcdState |= (1 << INSTR_DISPLAY_B);
   writeLCDInstr(INSTR_DISPLAY | lcdState);
 }
@@ -883,25 +1854,36 @@ void displayOff(void) {
 }
 
 void displayOn(void) {
+  syncCursorAddr();
   lcdState |= (1 << INSTR_DISPLAY_D);
   writeLCDInstr(INSTR_DISPLAY | lcdState);
 }
 
+uint8_t getDisplayState(void) {
+  return lcdState;
+}
+
 //-----------------------------------------------------------------------------------------------
 
 char readCharFromLCD(uint8_t row, uint8_t column) {
-  uint8_t old_row, old_column;
-  getCursorPosition(&old_row, &old_column);
+  uint8_t r = row ? row - 1 : 0;
+  uint8_t col = column ? column - 1 : 0;
+  if (r >= LCD_NUMBER_OF_LINES || col >= LCD_CHARACTERS_PER_LINE)
+    return ' '; // Off the screen
 
-  setCursorPosition(row, column);
+#ifdef LCD_SHADOW_ENABLE
+  return shadow[r*LCD_CHARACTERS_PER_LINE + col];
+#else
+  writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[r] + col));
 
   loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
   setLCDDBusAsInputs();
   char c = readLCDDBusByte_();
   setLCDDBusAsOutputs();
 
-  setCursorPosition(old_row, old_column);
+  cursorAddrStale = 1;
   return c;
+#endif
 }
 
 void readLCDLine(uint8_t i, char* str) {
@@ -912,42 +1894,236 @@ void readLCDLine(uint8_t i, char* str) {
 // Advanced functions for special cases
 
 void readCharsFromLCD(uint8_t from_row, uint8_t from_column, uint8_t to_row, uint8_t to_column, char* str, uint8_t len) {
-  uint8_t old_row, old_column;
-  getCursorPosition(&old_row, &old_column);
-  setCursorPosition(from_row, from_column);
-
-  for (uint8_t i = 0; i < len - 1 && from_row <= to_row; i++) {
-    if (from_row == LCD_NUMBER_OF_LINES && from_column == LCD_CHARACTERS_PER_LINE) {
-      // Last character on screen
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      setLCDDBusAsInputs();
-      *(str++) = readLCDDBusByte_();
-      setLCDDBusAsOutputs();
-    } else if (from_column == LCD_CHARACTERS_PER_LINE) { // End of line (but not last one)
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      setLCDDBusAsInputs();
-      *(str++) = readLCDDBusByte_();
-      setLCDDBusAsOutputs();
+  uint8_t row = from_row ? from_row - 1 : 0;
+  uint8_t column = from_column ? from_column - 1 : 0;
+  uint8_t last_row = to_row <= LCD_NUMBER_OF_LINES ? to_row : LCD_NUMBER_OF_LINES;
+
+  // Read each physical line in a single burst; the LCD increments its address counter after
+  // every data read, so the DDRAM address only needs to be set once per line
+  for (uint8_t i = 0; i < len - 1 && row < last_row; row++, column = 0) {
+    uint8_t end = (row == last_row - 1 && to_column && to_column < LCD_CHARACTERS_PER_LINE) ? to_column : LCD_CHARACTERS_PER_LINE;
+
+#ifdef LCD_SHADOW_ENABLE
+    // Served from the shadow copy; the LCD is not touched
+    for (; column < end && i < len - 1; column++, i++)
+      *(str++) = shadow[row*LCD_CHARACTERS_PER_LINE + column];
+  }
 
-      from_row += 1;
-      from_column = 1;
-      setCursorPosition(from_row, from_column);
-    } else {
-      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new instructions
-      setLCDDBusAsInputs();
-      *(str++) = readLCDDBusByte_();
-      setLCDDBusAsOutputs();
+  // Ensure array is terminated with null character
+  *str = '\0';
+#else
+    writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[row] + column));
+    setLCDDBusAsInputs();
 
-      from_column++;
+    for (; column < end && i < len - 1; column++, i++) {
+      pollLCDBusyFlag_(); // Wait for the previous read (and address increment) to complete
+      *(str++) = readLCDDBusByte_();
     }
+
+    setLCDDBusAsOutputs();
   }
 
   // Ensure array is terminated with null character
   *str = '\0';
 
-  setCursorPosition(old_row, old_column);
-  setLCDDBusAsOutputs();
+  cursorAddrStale = 1;
+#endif
+}
+
+void lcdFill(uint8_t row, uint8_t column, uint16_t count, char c) {
+  uint8_t r = row ? row - 1 : 0;
+  uint8_t col = column ? column - 1 : 0;
+
+  // One DDRAM address set per physical line; the LCD auto-increments between characters
+  for (; count > 0 && r < LCD_NUMBER_OF_LINES && col < LCD_CHARACTERS_PER_LINE; r++, col = 0) {
+    writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[r] + col));
+
+    for (; col < LCD_CHARACTERS_PER_LINE && count > 0; col++, count--) {
+      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new data
+      writeCharToLCD_(c);
+    }
+  }
+
+  // The LCD address counter is returned to the cursor lazily
+  cursorAddrStale = 1;
+}
+
+#ifdef LCD_SHADOW_ENABLE
+void beginLCDBurst(void) {
+  burst = 1;
+}
+
+void endLCDBurst(void) {
+  if (!burst)
+    return;
+  burst = 0;
+
+  // Paint each changed line in full; the shadow already holds the characters written
+  for (uint8_t row = 0; row < LCD_NUMBER_OF_LINES; row++) {
+    if (burstDirty & (1 << row))
+      writeCharsToLCD_(row, 0, shadow + row*LCD_CHARACTERS_PER_LINE, LCD_CHARACTERS_PER_LINE);
+  }
+  burstDirty = 0;
+
+  cursorAddrStale = 1;
+}
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+uint8_t beginLCDCheckpoint(void) {
+  checkpointHeader[0] = checkpointSeq + 1;
+  checkpointHeader[1] = currentLineNum;
+  checkpointHeader[2] = currentLineChars;
+  checkpointHeader[3] = lcdState;
+
+  // Nothing to write if the newest checkpoint holds the same state
+  if (checkpointSlot < CHECKPOINT_SLOTS) {
+    uint8_t* addr = checkpointAddr(checkpointSlot);
+    uint16_t i = 1;
+    for (; i < CHECKPOINT_HEADER + LCD_CHARACTERS_PER_SCREEN && eeprom_read_byte(addr + i) == checkpointByte(i); i++)
+      ;
+    if (i == CHECKPOINT_HEADER + LCD_CHARACTERS_PER_SCREEN)
+      return 0;
+  }
+
+  checkpointTarget = checkpointSlot < CHECKPOINT_SLOTS ? (checkpointSlot + 1) % CHECKPOINT_SLOTS : 0;
+  checkpointNext = 0;
+  checkpointCrc = checkpointCrcInit();
+  checkpointWriting = 1;
+  return 1;
+}
+
+uint8_t stepLCDCheckpoint(void) {
+  if (!checkpointWriting)
+    return 0;
+  if (!eeprom_is_ready())
+    return 1;
+
+  uint8_t b = checkpointByte(checkpointNext);
+  if (checkpointNext < CHECKPOINT_SLOT - 2)
+    checkpointCrc = _crc_ccitt_update(checkpointCrc, b);
+  eeprom_update_byte(checkpointAddr(checkpointTarget) + checkpointNext, b);
+
+  if (++checkpointNext < CHECKPOINT_SLOT)
+    return 1;
+
+  checkpointWriting = 0;
+  checkpointSlot = checkpointTarget;
+  checkpointSeq = checkpointHeader[0];
+  return 0;
+}
+#endif
+
+void lcdUpdate(uint8_t row, uint8_t column, const char* str, uint16_t count) {
+  uint8_t r = row ? row - 1 : 0;
+  uint8_t col = column ? column - 1 : 0;
+
+  for (; count > 0 && r < LCD_NUMBER_OF_LINES && col < LCD_CHARACTERS_PER_LINE; r++, col = 0) {
+#ifdef LCD_SHADOW_ENABLE
+    // Cells already holding their character are skipped; the DDRAM address is only set again
+    // after such a gap
+    uint8_t addrValid = 0;
+    for (; col < LCD_CHARACTERS_PER_LINE && count > 0; col++, count--, str++) {
+      if (shadow[r*LCD_CHARACTERS_PER_LINE + col] == *str) {
+        addrValid = 0;
+        continue;
+      }
+
+      if (!addrValid) {
+        writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[r] + col));
+        addrValid = 1;
+      }
+      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new data
+      writeCharToLCD_(*str);
+    }
+#else
+    writeLCDInstr(INSTR_DDRAM_ADDR | (lineBeginnings[r] + col));
+
+    for (; col < LCD_CHARACTERS_PER_LINE && count > 0; col++, count--) {
+      loop_until_LCD_BF_clear(); // Wait until LCD is ready for new data
+      writeCharToLCD_(*(str++));
+    }
+#endif
+  }
+
+  // The LCD address counter is returned to the cursor lazily
+  cursorAddrStale = 1;
+}
+
+#ifdef LCD_WIDGET_ENABLE
+uint8_t defineLCDWidget(uint8_t id, uint8_t type, uint8_t row, uint8_t column, uint8_t length) {
+  if (id >= LCD_WIDGET_COUNT)
+    return 0;
+
+  // The characters of the widget replaced are freed first, so that it can be redefined in place
+  lcdWidget* w = &widgets[id];
+  if (w->type != LCD_WIDGET_NONE)
+    glyphsUsed &= ~widgetGlyphs(w);
+  w->type = LCD_WIDGET_NONE;
+
+  if (type == LCD_WIDGET_NONE || length == 0)
+    return 1;
+
+  uint8_t r = row ? row - 1 : 0;
+  uint8_t col = column ? column - 1 : 0;
+  if (r >= LCD_NUMBER_OF_LINES || col >= LCD_CHARACTERS_PER_LINE)
+    return 0;
+
+  switch (type) {
+  case LCD_WIDGET_HBAR:
+    if (length > LCD_CHARACTERS_PER_LINE - col) return 0;
+    break;
+  case LCD_WIDGET_VBAR:
+    if (length > r + 1) return 0;
+    break;
+  case LCD_WIDGET_SPARKLINE:
+    if (length > LCD_CHARACTERS_PER_LINE - col || length > 8) return 0;
+    break;
+  default:
+    return 0;
+  }
+
+  w->type = type;
+  w->row = r;
+  w->column = col;
+  w->length = length;
+  w->value = 0;
+
+  // First run of free characters that fits
+  uint8_t count = type == LCD_WIDGET_SPARKLINE ? length : 1;
+  for (w->glyph = 0; w->glyph + count <= 8 && (glyphsUsed & widgetGlyphs(w)); w->glyph++)
+    ;
+  if (w->glyph + count > 8) {
+    w->type = LCD_WIDGET_NONE;
+    return 0;
+  }
+  glyphsUsed |= widgetGlyphs(w);
+
+  if (type == LCD_WIDGET_SPARKLINE) {
+    static const uint8_t empty[8];
+    for (uint8_t i = 0; i < length; i++)
+      writeGlyph(w->glyph + i, empty);
+    drawSparkline(w);
+  } else {
+    drawBar(w);
+  }
+  return 1;
+}
+
+void setLCDWidget(uint8_t id, uint8_t value) {
+  if (id >= LCD_WIDGET_COUNT || widgets[id].type == LCD_WIDGET_NONE)
+    return;
+
+  lcdWidget* w = &widgets[id];
+  w->value = value;
+  if (w->type == LCD_WIDGET_SPARKLINE) {
+    pushSparkline(w);
+    drawSparkline(w);
+  } else {
+    drawBar(w);
+  }
 }
+#endif
 
 /*
   Initialize LCD using the internal reset circuitry.
@@ -965,5 +2141,5 @@ void initLCDByInternalReset(void) {
   writeLCDInstr_(0x0F);
   writeLCDInstr_(0x06);
   writeLCDInstr_(CMD_CLEAR_DISPLAY);
-  _delay_ms(LCD_CLEAR_DISPLAY_DELAY);
+  _delay_us(LCD_CLEAR_DISPLAY_DELAY);
 }
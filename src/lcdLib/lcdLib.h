@@ -26,6 +26,7 @@
 #define LCD_LIB_H
 
 // Includes -----------------------------------------------------------------------------------
+#include <stdio.h>
 #include "lcd_instr.h"
 #include "lcdLibConfig.h"
 
@@ -33,7 +34,8 @@
 // Library function declarations
 
 /**
-  Initialize the LCD display via software initialization as specified by the datasheet.
+  Initialize the LCD display via software initialization as specified by the datasheet. With
+  LCD_CHECKPOINT_ENABLE, the last checkpoint (if any) is then restored.
 */
 void initLCD(void);
 
@@ -49,6 +51,21 @@ void writeCharToLCD(char);
  */
 void writeStringToLCD(char*);
 
+/**
+  Sets the function used to reply to queries received as ANSI escapes (eg. the cursor position
+  report answering DSR 6). The handler is given a null terminated string to send to the host;
+  it should queue the reply rather than wait on the transport. No replies are sent when unset.
+ */
+void setLCDResponseHandler(void (*handler)(const char*));
+
+/**
+  Returns a write only stdio stream on the LCD (set up by the first call), so that eg. fprintf_P
+  formats straight to the display without an intermediate buffer. Characters go through
+  writeCharToLCD; with LCD_ANSI_ESCAPE_ENABLE, an escape sequence (of up to eight bytes after
+  the CSI) is collected as it is written and then executed as by writeStringToLCD.
+ */
+FILE* openLCDStream(void);
+
 //---------------------------------------------------------------------------------------------
 // LCD command functions (all have associated ANSI escape)
 
@@ -110,15 +127,25 @@ void moveCursorPreviousLine(uint8_t n);
 void moveCursorToColumn(uint8_t n);
 
 /**
-   Scroll whole page up by n lines. New lines are added at the bottom.
+   Scroll the scrolling region (the whole page by default) up by n lines. New lines are added at
+   the bottom of the region.
  */
 void scrollUp(uint8_t n);
 
 /**
-   Scroll whole page down by n lines. New lines are added at the top.
+   Scroll the scrolling region (the whole page by default) down by n lines. New lines are added
+   at the top of the region.
  */
 void scrollDown(uint8_t n);
 
+/**
+   Sets the scrolling region to lines top through bottom (inclusive). Line feeds on the bottom
+   line of the region and scrolls only rewrite lines within it. A top or bottom of 0 selects the
+   first or last line of the screen respectively. The cursor is moved to the home position.
+   Note indexes start at 1.
+ */
+void setScrollRegion(uint8_t top, uint8_t bottom);
+
 /**
    Saves the cursors current position.
  */
@@ -132,7 +159,7 @@ void restoreCursorPosition(void);
 /**
    Clears part or all of screen dependent on the value of n:
    0 or missing: clear from cursor to end of screen
-   1: clear from cursor to end of screen
+   1: clear from cursor to beginning of screen
    2: clear entire screen
  */
 void eraseDisplay(uint8_t n);
@@ -145,6 +172,38 @@ void eraseDisplay(uint8_t n);
  */
 void eraseInline(uint8_t n);
 
+/**
+   Inserts n blank lines at the cursor line, pushing the lines below it down within the
+   scrolling region. The cursor moves to the beginning of the line. Has no effect when the
+   cursor is outside the scrolling region.
+ */
+void insertLines(uint8_t n);
+
+/**
+   Deletes n lines starting at the cursor line, pulling the lines below it up within the
+   scrolling region. The cursor moves to the beginning of the line. Has no effect when the
+   cursor is outside the scrolling region.
+ */
+void deleteLines(uint8_t n);
+
+/**
+   Inserts n blank characters at the cursor, shifting the rest of the line right. Characters
+   shifted past the end of the line are lost. The cursor does not move.
+ */
+void insertChars(uint8_t n);
+
+/**
+   Deletes n characters at the cursor, shifting the rest of the line left and filling the end of
+   the line with blanks. The cursor does not move.
+ */
+void deleteChars(uint8_t n);
+
+/**
+   Erases n characters from the cursor to the right (stopping at the end of the line) without
+   moving the cursor.
+ */
+void eraseChars(uint8_t n);
+
 /**
    Hides the cursor
  */
@@ -168,6 +227,13 @@ void blinkCursorOff(void);
  */
 void blinkCursorOn(void);
 
+/**
+   Cursor motions are applied to the LCD lazily (on the next character write or visible cursor
+   change). Brings the visible cursor up to date with the current cursor position; call this
+   when input goes idle.
+ */
+void flushCursorPosition(void);
+
 /**
    Turns the display off.
  */
@@ -178,11 +244,17 @@ void displayOff(void);
  */
 void displayOn(void);
 
+/**
+   Returns the display control state (the INSTR_DISPLAY_D, INSTR_DISPLAY_C and INSTR_DISPLAY_B
+   bits of the last INSTR_DISPLAY instruction).
+ */
+uint8_t getDisplayState(void);
+
 //---------------------------------------------------------------------------------------------
 
 /**
    Read a single character from the row and column given (1 based) returning the cursor to
-   its previous original position.
+   its previous original position. Positions off the screen read as a space.
  */
 char readCharFromLCD(uint8_t row, uint8_t column);
 
@@ -199,9 +271,116 @@ void readLCDLine(uint8_t i, char* str);
    to its original position after the read. Upon success (not overflowing the screen), 0 is
    returned; otherwise non zero will be returned. The str pointer will be updated with the
    characters read from the screen. Even in the case of failure, str may be partially populated.
+
+   Each physical line is read in a single burst using the LCD's address auto-increment; the data
+   bus is only switched to inputs once per line. When LCD_SHADOW_ENABLE is defined the characters
+   are instead copied from the SRAM shadow of the screen without accessing the LCD.
  */
 void readCharsFromLCD(uint8_t from_row, uint8_t from_column, uint8_t to_row, uint8_t to_column, char* str, uint8_t len);
 
+/**
+   Fill count cells with the character c starting at (row, column) and continuing onto
+   subsequent lines, stopping at the end of the screen. The cursor position is unaffected and
+   no wrapping or scrolling is performed. Indexes start at 1.
+ */
+void lcdFill(uint8_t row, uint8_t column, uint16_t count, char c);
+
+/**
+   Write count characters from str starting at (row, column) and continuing onto subsequent
+   lines, stopping at the end of the screen. Like lcdFill, the cursor position is unaffected and
+   no wrapping or scrolling is performed. Indexes start at 1.
+
+   When LCD_SHADOW_ENABLE is defined, cells that already hold their character are not written.
+ */
+void lcdUpdate(uint8_t row, uint8_t column, const char* str, uint16_t count);
+
+#ifdef LCD_SHADOW_ENABLE
+/**
+   Begin a burst: until endLCDBurst, changes to the screen contents (text, erasing and
+   scrolling) are only made to the SRAM shadow and the LCD is not written. Intended for input
+   arriving faster than it can be rendered, of which only the final screen will be visible.
+ */
+void beginLCDBurst(void);
+
+/**
+   End a burst, writing each line that changed during it to the LCD once.
+ */
+void endLCDBurst(void);
+#endif
+
+#ifdef LCD_WIDGET_ENABLE
+// Widget types (see defineLCDWidget)
+#define LCD_WIDGET_NONE      0
+#define LCD_WIDGET_HBAR      1      ///< Horizontal bar, extending right
+#define LCD_WIDGET_VBAR      2      ///< Vertical bar, extending up
+#define LCD_WIDGET_SPARKLINE 3      ///< Five samples per cell, newest at the right
+
+/**
+   Define widget id (0 to LCD_WIDGET_COUNT - 1) as a widget of the given type, length cells long,
+   at (row, column), replacing any widget of that id; a length of 0 (or LCD_WIDGET_NONE) removes
+   it. Indexes start at 1. The widget starts out empty. Returns non-zero on success; the widget
+   must fit on the screen and in the CGRAM characters the other widgets leave free (a bar takes
+   one, a sparkline one per cell).
+
+   Widgets show CGRAM characters as their aliases 0x08-0x0f. The cells of a widget are not
+   reserved: text written over them stays until the widget is next set.
+
+   With LCD_ANSI_ESCAPE_ENABLE, widgets are also defined at the cursor by the private sequences
+   ESC[=id;lengthb (horizontal bar), ESC[=id;lengthc (vertical bar) and ESC[=id;lengths
+   (sparkline), and set by ESC[=id;valuev.
+ */
+uint8_t defineLCDWidget(uint8_t id, uint8_t type, uint8_t row, uint8_t column, uint8_t length);
+
+/**
+   Set widget id to value, from 0 (empty) to 255 (full scale): the level of a bar, or a new
+   sample for a sparkline, which scrolls the others left by one pixel column. Only the glyph
+   rows and cells that change are written.
+ */
+void setLCDWidget(uint8_t id, uint8_t value);
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+/**
+   Begin writing a checkpoint of the screen contents, cursor position and display state to the
+   next of the EEPROM checkpoint slots, to be restored by initLCD. Returns zero (and writes
+   nothing) if the last checkpoint already holds the current state.
+
+   Writing an EEPROM byte takes about 3.4ms, so the checkpoint is written a byte at a time by
+   stepLCDCheckpoint; the screen should not change until it completes. A checkpoint that is not
+   completed (abandoned or interrupted by a reset) is ignored in favour of the previous one.
+ */
+uint8_t beginLCDCheckpoint(void);
+
+/**
+   Write the next byte of the checkpoint begun by beginLCDCheckpoint, if the EEPROM is ready.
+   Returns non-zero until the checkpoint is complete.
+ */
+uint8_t stepLCDCheckpoint(void);
+#endif
+
+#ifdef LCD_BF_TIMEOUT
+/**
+   Re-run the software initialization and repaint the screen from the SRAM shadow (without
+   LCD_SHADOW_ENABLE the screen is cleared instead), restoring the cursor and display state.
+   Returns non-zero if the LCD responded.
+
+   This is done automatically when a busy flag wait exceeds LCD_BF_TIMEOUT. If the LCD still
+   does not respond it is left faulted: busy flag waits are skipped, so output carries on (and
+   the shadow stays current) without stalling, until recoverLCD is called again and succeeds.
+ */
+uint8_t recoverLCD(void);
+
+/**
+   Returns non-zero while the LCD is faulted (see recoverLCD).
+ */
+uint8_t isLCDFaulted(void);
+
+/**
+   Returns the number of busy flag waits that timed out since reset.
+ */
+uint16_t getLCDFaultCount(void);
+#endif
+
 /**
   Initialize the LCD display via its internal reset circuit.
 
@@ -233,6 +412,19 @@ void initLCDByInternalReset(void);
 #define LCD_CHARACTERS_PER_SCREEN (LCD_CHARACTERS_PER_LINE * LCD_NUMBER_OF_LINES)
 #endif
 
+#if defined(LCD_CHECKPOINT_ENABLE) && !defined(LCD_SHADOW_ENABLE)
+#error "LCD_CHECKPOINT_ENABLE requires LCD_SHADOW_ENABLE."
+#elif defined(LCD_CHECKPOINT_ENABLE) && \
+      LCD_CHECKPOINT_EEPROM_SIZE < 2 * (LCD_CHARACTERS_PER_SCREEN + 6)
+#error "LCD_CHECKPOINT_EEPROM_SIZE must hold at least two checkpoints."
+#endif
+
+#if defined(LCD_WIDGET_ENABLE) && !defined(LCD_SHADOW_ENABLE)
+#error "LCD_WIDGET_ENABLE requires LCD_SHADOW_ENABLE."
+#elif defined(LCD_WIDGET_ENABLE) && !defined(LCD_FONT_5x8)
+#error "LCD_WIDGET_ENABLE requires LCD_FONT_5x8."
+#endif
+
 #if !defined(LCD_FONT_5x8) &&\
     !defined(LCD_FONT_5x10)
 #error "All modes require LCD_FONT_5x8 or LCD_FONT_5x10 to be defined."
@@ -245,6 +437,173 @@ void initLCDByInternalReset(void);
 #define LCD_FONT (1 << INSTR_FUNC_SET_F)
 #endif
 
+#ifdef PCF8574_MODE
+#if defined (LCD_DEFAULT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE) || \
+    defined (FOUR_BIT_MODE)    || defined (HC595_MODE)
+#error "PCF8574_MODE is mutually exclusive with the other modes. Choose one."
+#endif
+#if !defined (LCD_PCF8574_ADDRESS)  || \
+    !defined (LCD_PCF8574_BIT_RATE) || \
+    !defined (LCD_PCF8574_RS)       || \
+    !defined (LCD_PCF8574_RW)       || \
+    !defined (LCD_PCF8574_ENABLE)   || \
+    !defined (LCD_PCF8574_DBUS4)    || \
+    !defined (LCD_PCF8574_DBUS5)    || \
+    !defined (LCD_PCF8574_DBUS6)    || \
+    !defined (LCD_PCF8574_DBUS7)
+#error "PCF8574_MODE requires that LCD_PCF8574_[ADDRESS,BIT_RATE,RS,RW,ENABLE,DBUS*] be defined."
+#endif
+
+// The expander drives the LCD in 4-bit mode and can't read it back. Its pins stand in for the IO
+// pins of FOUR_BIT_MODE: lcdLib.c keeps their levels in lcdExpander and sends it to the expander
+// on every enable edge (the direction registers are ignored)
+#define FOUR_BIT_MODE
+#ifndef LCD_WRITE_ONLY
+#define LCD_WRITE_ONLY
+#endif
+
+#undef  LCD_RS
+#define LCD_RS          LCD_PCF8574_RS
+#undef  LCD_RS_PORT
+#define LCD_RS_PORT     lcdExpander
+#undef  LCD_RS_DDR
+#define LCD_RS_DDR      lcdExpanderDdr
+
+#undef  LCD_RW
+#define LCD_RW          LCD_PCF8574_RW
+#undef  LCD_RW_PORT
+#define LCD_RW_PORT     lcdExpander
+#undef  LCD_RW_DDR
+#define LCD_RW_DDR      lcdExpanderDdr
+
+#undef  LCD_ENABLE
+#define LCD_ENABLE      LCD_PCF8574_ENABLE
+#undef  LCD_ENABLE_PORT
+#define LCD_ENABLE_PORT lcdExpander
+#undef  LCD_ENABLE_DDR
+#define LCD_ENABLE_DDR  lcdExpanderDdr
+
+#undef  LCD_DBUS4
+#define LCD_DBUS4       LCD_PCF8574_DBUS4
+#undef  LCD_DBUS4_PORT
+#define LCD_DBUS4_PORT  lcdExpander
+#undef  LCD_DBUS4_DDR
+#define LCD_DBUS4_DDR   lcdExpanderDdr
+#undef  LCD_DBUS4_PIN
+#define LCD_DBUS4_PIN   lcdExpander
+
+#undef  LCD_DBUS5
+#define LCD_DBUS5       LCD_PCF8574_DBUS5
+#undef  LCD_DBUS5_PORT
+#define LCD_DBUS5_PORT  lcdExpander
+#undef  LCD_DBUS5_DDR
+#define LCD_DBUS5_DDR   lcdExpanderDdr
+#undef  LCD_DBUS5_PIN
+#define LCD_DBUS5_PIN   lcdExpander
+
+#undef  LCD_DBUS6
+#define LCD_DBUS6       LCD_PCF8574_DBUS6
+#undef  LCD_DBUS6_PORT
+#define LCD_DBUS6_PORT  lcdExpander
+#undef  LCD_DBUS6_DDR
+#define LCD_DBUS6_DDR   lcdExpanderDdr
+#undef  LCD_DBUS6_PIN
+#define LCD_DBUS6_PIN   lcdExpander
+
+#undef  LCD_DBUS7
+#define LCD_DBUS7       LCD_PCF8574_DBUS7
+#undef  LCD_DBUS7_PORT
+#define LCD_DBUS7_PORT  lcdExpander
+#undef  LCD_DBUS7_DDR
+#define LCD_DBUS7_DDR   lcdExpanderDdr
+#undef  LCD_DBUS7_PIN
+#define LCD_DBUS7_PIN   lcdExpander
+#endif
+
+#ifdef HC595_MODE
+#if defined (LCD_DEFAULT_MODE) || defined (EIGHT_BIT_ARBITRARY_PIN_MODE) || \
+    defined (FOUR_BIT_MODE)    || defined (PCF8574_MODE)
+#error "HC595_MODE is mutually exclusive with the other modes. Choose one."
+#endif
+#if !defined (LCD_HC595_MOSI)       || \
+    !defined (LCD_HC595_SCK)        || \
+    !defined (LCD_HC595_SPI_DDR)    || \
+    !defined (LCD_HC595_LATCH)      || \
+    !defined (LCD_HC595_LATCH_PORT) || \
+    !defined (LCD_HC595_LATCH_DDR)  || \
+    !defined (LCD_HC595_RS)         || \
+    !defined (LCD_HC595_RW)         || \
+    !defined (LCD_HC595_DBUS4)      || \
+    !defined (LCD_HC595_DBUS5)      || \
+    !defined (LCD_HC595_DBUS6)      || \
+    !defined (LCD_HC595_DBUS7)
+#error "HC595_MODE requires that LCD_HC595_[MOSI,SCK,SPI_DDR,LATCH*,RS,RW,DBUS*] be defined."
+#endif
+
+// The shift register drives RS, RW and the data lines of the LCD in 4-bit mode and can't read it
+// back; enable stays on its IO pin. The shift register outputs stand in for the IO pins of
+// FOUR_BIT_MODE: lcdLib.c keeps their levels in lcdShiftRegister and shifts them out before each
+// enable pulse (the direction registers are ignored)
+#define FOUR_BIT_MODE
+#ifndef LCD_WRITE_ONLY
+#define LCD_WRITE_ONLY
+#endif
+
+#undef  LCD_RS
+#define LCD_RS          LCD_HC595_RS
+#undef  LCD_RS_PORT
+#define LCD_RS_PORT     lcdShiftRegister
+#undef  LCD_RS_DDR
+#define LCD_RS_DDR      lcdShiftRegisterDdr
+
+#undef  LCD_RW
+#define LCD_RW          LCD_HC595_RW
+#undef  LCD_RW_PORT
+#define LCD_RW_PORT     lcdShiftRegister
+#undef  LCD_RW_DDR
+#define LCD_RW_DDR      lcdShiftRegisterDdr
+
+#undef  LCD_DBUS4
+#define LCD_DBUS4       LCD_HC595_DBUS4
+#undef  LCD_DBUS4_PORT
+#define LCD_DBUS4_PORT  lcdShiftRegister
+#undef  LCD_DBUS4_DDR
+#define LCD_DBUS4_DDR   lcdShiftRegisterDdr
+#undef  LCD_DBUS4_PIN
+#define LCD_DBUS4_PIN   lcdShiftRegister
+
+#undef  LCD_DBUS5
+#define LCD_DBUS5       LCD_HC595_DBUS5
+#undef  LCD_DBUS5_PORT
+#define LCD_DBUS5_PORT  lcdShiftRegister
+#undef  LCD_DBUS5_DDR
+#define LCD_DBUS5_DDR   lcdShiftRegisterDdr
+#undef  LCD_DBUS5_PIN
+#define LCD_DBUS5_PIN   lcdShiftRegister
+
+#undef  LCD_DBUS6
+#define LCD_DBUS6       LCD_HC595_DBUS6
+#undef  LCD_DBUS6_PORT
+#define LCD_DBUS6_PORT  lcdShiftRegister
+#undef  LCD_DBUS6_DDR
+#define LCD_DBUS6_DDR   lcdShiftRegisterDdr
+#undef  LCD_DBUS6_PIN
+#define LCD_DBUS6_PIN   lcdShiftRegister
+
+#undef  LCD_DBUS7
+#define LCD_DBUS7       LCD_HC595_DBUS7
+#undef  LCD_DBUS7_PORT
+#define LCD_DBUS7_PORT  lcdShiftRegister
+#undef  LCD_DBUS7_DDR
+#define LCD_DBUS7_DDR   lcdShiftRegisterDdr
+#undef  LCD_DBUS7_PIN
+#define LCD_DBUS7_PIN   lcdShiftRegister
+#endif
+
+#if defined (LCD_WRITE_ONLY) && !defined (LCD_SHADOW_ENABLE)
+#error "LCD_WRITE_ONLY (or PCF8574_MODE, HC595_MODE) requires LCD_SHADOW_ENABLE; the LCD can't be read."
+#endif
+
 #if !defined (LCD_RS)          || \
     !defined (LCD_RS_PORT)     || \
     !defined (LCD_RS_DDR)      || \
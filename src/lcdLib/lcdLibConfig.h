@@ -32,25 +32,38 @@
   Usage
   =====
 
-  Operates in 3 mutually exclusive modes:
+  Operates in 5 mutually exclusive modes:
   1. Default Mode
      8-bit mode that requires all its data bus lines be on the same PORT.
   2. EIGHT_BIT_ARBITRARY_PIN_MODE
      8-bit mode that allows the data bus lines to use any IO pin.
   3. FOUR_BIT_MODE
      4-bit mode that allows the data bus lines to use any IO pin.
+  4. PCF8574_MODE
+     4-bit mode through a PCF8574 I2C port expander (the common LCD backpack) on the TWI;
+     write only (see LCD_WRITE_ONLY).
+  5. HC595_MODE
+     4-bit mode through a 74HC595 shift register clocked by the SPI (enable stays on an IO
+     pin); write only (see LCD_WRITE_ONLY).
 */
 
 /*
   Screen characteristics
 */
 
+// The screen characteristics may be overridden from the build (eg. -DLCD_NUMBER_OF_LINES=2)
+#ifndef LCD_CHARACTERS_PER_LINE
 #define LCD_CHARACTERS_PER_LINE 20      ///< Number of characters per line of the LCD
+#endif
+#ifndef LCD_NUMBER_OF_LINES
 #define LCD_NUMBER_OF_LINES     4       ///< Number of lines of the LCD
+#endif
+#ifndef LCD_LINE_BEGINNINGS
 #define LCD_LINE_BEGINNINGS     0x00, \
                                 0x40, \
                                 0x14, \
                                 0x54    ///< Memory locations for each physical line ordered 1 to LCD_NUMBER_OF_LINES
+#endif
 
 /* Which font to use (can only leave one uncommented) */
 #define LCD_FONT_5x8
@@ -59,6 +72,33 @@
 /* Support ANSI escapes; comment to disable */
 #define LCD_ANSI_ESCAPE_ENABLE
 
+/* Keep a copy of the display contents in SRAM (LCD_CHARACTERS_PER_SCREEN bytes); reads of the
+   screen are then served from it and unchanged cells can be skipped. Comment to disable */
+#define LCD_SHADOW_ENABLE
+
+/* Bar graph and sparkline widgets drawn with the CGRAM characters (see defineLCDWidget);
+   requires LCD_SHADOW_ENABLE and LCD_FONT_5x8. Comment to disable */
+#define LCD_WIDGET_ENABLE
+#define LCD_WIDGET_COUNT        4       ///< Widgets that can be defined at once
+
+/* Checkpoint the screen, cursor and display state to EEPROM (see beginLCDCheckpoint) and restore
+   them in initLCD; requires LCD_SHADOW_ENABLE. Uncomment (or define from the build) to enable */
+//#define LCD_CHECKPOINT_ENABLE
+
+// EEPROM bytes used for checkpoints; as many checkpoints as fit are written in turn
+#ifndef LCD_CHECKPOINT_EEPROM_START
+#define LCD_CHECKPOINT_EEPROM_START 0
+#endif
+#ifndef LCD_CHECKPOINT_EEPROM_SIZE
+#define LCD_CHECKPOINT_EEPROM_SIZE  (E2END + 1)
+#endif
+
+/* Never read the LCD (RW tied low): the busy flag is not polled and each transfer is instead
+   given the worst case execution time (LCD_GENERIC_INSTR_DELAY, or LCD_CLEAR_DISPLAY_DELAY for a
+   clear or return home). Requires LCD_SHADOW_ENABLE; implied by PCF8574_MODE and HC595_MODE.
+   Uncomment (or define from the build) to enable */
+//#define LCD_WRITE_ONLY
+
 /* Modes */
 
 // Default mode: 8-bit data bus
@@ -66,10 +106,23 @@
 // 8-bit mode with data bus on arbitrary pins
 //#define EIGHT_BIT_ARBITRARY_PIN_MODE
 
+// LCD in 4-bit mode through a PCF8574 I2C backpack
+//#define PCF8574_MODE
+
+// LCD in 4-bit mode through a 74HC595 shift register on the SPI
+//#define HC595_MODE
+
 // LCD in 4-bit mode (on arbitrary pins)
+//
+// The mode may also be chosen from the build by defining LCD_DEFAULT_MODE,
+// EIGHT_BIT_ARBITRARY_PIN_MODE, FOUR_BIT_MODE, PCF8574_MODE or HC595_MODE, in which case this
+// default is skipped
+#if !defined (LCD_DEFAULT_MODE) && !defined (EIGHT_BIT_ARBITRARY_PIN_MODE) && \
+    !defined (FOUR_BIT_MODE) && !defined (PCF8574_MODE) && !defined (HC595_MODE)
 #define FOUR_BIT_MODE
+#endif
 
-/* All mode options */
+/* All mode options (except PCF8574_MODE; HC595_MODE only uses LCD_ENABLE) */
 
 #define LCD_RS          PD2
 #define LCD_RS_PORT     PORTD
@@ -110,6 +163,7 @@
 #define LCD_DBUS1_DDR  DDRB
 #define LCD_DBUS1_PIN  PINB
 
+#ifndef SPI_INPUT_ENABLE
 #define LCD_DBUS2      PB2
 #define LCD_DBUS2_PORT PORTB
 #define LCD_DBUS2_DDR  DDRB
@@ -119,9 +173,22 @@
 #define LCD_DBUS3_PORT PORTB
 #define LCD_DBUS3_DDR  DDRB
 #define LCD_DBUS3_PIN  PINB
+#else
+// PB2 and PB3 are SS and MOSI of the SPI slave (see SPI.h)
+#define LCD_DBUS2      PB6
+#define LCD_DBUS2_PORT PORTB
+#define LCD_DBUS2_DDR  DDRB
+#define LCD_DBUS2_PIN  PINB
+
+#define LCD_DBUS3      PB7
+#define LCD_DBUS3_PORT PORTB
+#define LCD_DBUS3_DDR  DDRB
+#define LCD_DBUS3_PIN  PINB
+#endif
 
 /* FOUR_BIT_MODE and EIGHT_BIT_ARBITRARY_PIN_MODE shared settings */
 
+#ifndef SPI_INPUT_ENABLE
 #define LCD_DBUS4      PB4
 #define LCD_DBUS4_PORT PORTB
 #define LCD_DBUS4_DDR  DDRB
@@ -141,6 +208,71 @@
 #define LCD_DBUS7_PORT PORTB
 #define LCD_DBUS7_DDR  DDRB
 #define LCD_DBUS7_PIN  PINB
+#else
+// PB4 and PB5 are MISO and SCK of the SPI slave (see SPI.h)
+#define LCD_DBUS4      PC0
+#define LCD_DBUS4_PORT PORTC
+#define LCD_DBUS4_DDR  DDRC
+#define LCD_DBUS4_PIN  PINC
+
+#define LCD_DBUS5      PC1
+#define LCD_DBUS5_PORT PORTC
+#define LCD_DBUS5_DDR  DDRC
+#define LCD_DBUS5_PIN  PINC
+
+#define LCD_DBUS6      PC2
+#define LCD_DBUS6_PORT PORTC
+#define LCD_DBUS6_DDR  DDRC
+#define LCD_DBUS6_PIN  PINC
+
+#define LCD_DBUS7      PC3
+#define LCD_DBUS7_PORT PORTC
+#define LCD_DBUS7_DDR  DDRC
+#define LCD_DBUS7_PIN  PINC
+#endif
+
+// Marks the LCD pins as clear of the SPI pins PB2-PB5, which SPI_INPUT_ENABLE requires (see
+// SPI.c); keep it only for wirings that leave them free
+#ifdef SPI_INPUT_ENABLE
+#define LCD_PINS_CLEAR_OF_SPI
+#endif
+
+/* PCF8574_MODE specific settings */
+
+#define LCD_PCF8574_ADDRESS     0x27    ///< Seven bit address (0x20-0x27; 0x38-0x3f for a PCF8574A)
+#define LCD_PCF8574_BIT_RATE    400000  ///< SCL frequency (the usual backpacks work at 400kHz)
+#define LCD_PCF8574_BUFFER_SIZE 32      ///< Bytes queued for the expander; must be a power of two
+
+// Expander pins (P0-P7) of the LCD lines, as wired on most backpacks
+#define LCD_PCF8574_RS          0
+#define LCD_PCF8574_RW          1
+#define LCD_PCF8574_ENABLE      2
+#define LCD_PCF8574_BACKLIGHT   3       ///< Driven high (backlight on); comment out if not wired
+#define LCD_PCF8574_DBUS4       4
+#define LCD_PCF8574_DBUS5       5
+#define LCD_PCF8574_DBUS6       6
+#define LCD_PCF8574_DBUS7       7
+
+/* HC595_MODE specific settings */
+
+// The SPI pins (fixed on the ATmega328P); SS is set as an output so the SPI stays master, and
+// clocks the shift register outputs (RCLK) by default
+#define LCD_HC595_MOSI          PB3
+#define LCD_HC595_SCK           PB5
+#define LCD_HC595_SPI_DDR       DDRB
+
+#define LCD_HC595_LATCH         PB2
+#define LCD_HC595_LATCH_PORT    PORTB
+#define LCD_HC595_LATCH_DDR     DDRB
+
+// Shift register outputs (Q0-Q7) of the LCD lines; RW is held low (or may be tied to ground)
+#define LCD_HC595_RS            0
+#define LCD_HC595_RW            1
+#define LCD_HC595_BACKLIGHT     3       ///< Driven high (backlight on); comment out if not wired
+#define LCD_HC595_DBUS4         4
+#define LCD_HC595_DBUS5         5
+#define LCD_HC595_DBUS6         6
+#define LCD_HC595_DBUS7         7
 
 
 /* LCD delays (in microseconds when unspecified) */
@@ -151,6 +283,10 @@
 #define LCD_INIT_DELAY1         8200
 #define LCD_INIT_DELAY2         200
 
-#define LCD_CLEAR_DISPLAY_DELAY 16000
-#define LCD_RETURN_HOME_DELAY   16000
+#define LCD_CLEAR_DISPLAY_DELAY 1600
+#define LCD_RETURN_HOME_DELAY   1600
 #define LCD_GENERIC_INSTR_DELAY 50
+
+/* Longest wait for the busy flag to clear (a clear display takes about 1.6ms) before the LCD is
+   considered faulted and re-initialized (see recoverLCD). Comment out to wait indefinitely */
+#define LCD_BF_TIMEOUT          10000
@@ -55,7 +55,7 @@
 #define INSTR_FUNC_SET_F     2
 
 // Set CG RAM address instruction
-#define INSTR_CGRAM_ADDR     0x60
+#define INSTR_CGRAM_ADDR     0x40
 
 // Set DD RAM address instruction
 #define INSTR_DDRAM_ADDR     0x80
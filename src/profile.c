@@ -0,0 +1,96 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: profile.c
+ */
+
+#include "profile.h"
+
+#ifdef PROFILE_ENABLE
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+typedef struct {
+  uint16_t count;  /* passes through the section (saturates) */
+  uint32_t total;  /* cycles spent in the section */
+  uint32_t max;    /* longest single pass */
+} profileCounter;
+
+static profileCounter counters[PROFILE_SECTIONS];
+static volatile uint16_t overflows; /* upper 16 bits of the cycle count */
+
+static const char* const sectionNames[PROFILE_SECTIONS] = {
+  "bf", "scrollup", "scrolldown", "csi", "rx"
+};
+
+ISR(TIMER1_OVF_vect) {
+  overflows++;
+}
+
+void initProfile(void) {
+  memset(counters, 0, sizeof(counters));
+  overflows = 0;
+
+  TCCR1A = 0;           // Normal mode
+  TCNT1 = 0;
+  TIMSK1 |= (1 << TOIE1);
+  TCCR1B = (1 << CS10); // clk/1
+}
+
+uint32_t profileCycles(void) {
+  uint8_t sreg = SREG;
+  cli();
+
+  uint16_t count = TCNT1;
+  uint16_t high = overflows;
+
+  // An overflow occurred but its interrupt hasn't run yet
+  if (bit_is_set(TIFR1, TOV1) && count < 0x8000)
+    high++;
+
+  SREG = sreg;
+  return ((uint32_t) high << 16) | count;
+}
+
+void profileRecord(uint8_t section, uint32_t start) {
+  uint32_t elapsed = profileCycles() - start;
+  profileCounter* c = &counters[section];
+
+  if (c->count < UINT16_MAX) c->count++;
+  c->total += elapsed;
+  if (elapsed > c->max) c->max = elapsed;
+}
+
+void dumpProfile(FILE* out) {
+  for (uint8_t i = 0; i < PROFILE_SECTIONS; i++) {
+    // Take and reset the counter at once, as the receive interrupt records into it too
+    uint8_t sreg = SREG;
+    cli();
+    profileCounter c = counters[i];
+    memset(&counters[i], 0, sizeof(profileCounter));
+    SREG = sreg;
+
+    fprintf_P(out, PSTR("%s %u %lu %lu\n"), sectionNames[i], c.count,
+              (unsigned long) c.total, (unsigned long) c.max);
+  }
+}
+
+#endif
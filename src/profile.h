@@ -0,0 +1,91 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file profile.h
+ * @brief Optional cycle count profiling of code sections using Timer1.
+ *
+ * Built only when PROFILE_ENABLE is defined (eg. CPPFLAGS += -DPROFILE_ENABLE); otherwise the
+ * PROFILE_BEGIN/PROFILE_END markers expand to nothing and no timer or memory is used. When
+ * enabled, Timer1 runs from the unprescaled CPU clock and its overflow interrupt extends it to
+ * 32 bits (wrapping after 2^32 cycles, about 9 minutes at 8MHz); global interrupts must be
+ * enabled.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+   Profiled sections.
+ */
+#define PROFILE_BF_WAIT      0 ///< Waiting for the LCD busy flag to clear
+#define PROFILE_SCROLL_UP    1 ///< scrollUp (including scrolls caused by line wraps)
+#define PROFILE_SCROLL_DOWN  2 ///< scrollDown
+#define PROFILE_CSI          3 ///< Parsing and executing a control sequence
+#define PROFILE_USART_RX     4 ///< The USART receive interrupt (buffering and echo)
+#define PROFILE_SECTIONS     5
+
+/**
+   Private control sequence that dumps (and then resets) the counters.
+ */
+#define PROFILE_DUMP_SEQUENCE "\e[=1p"
+
+#ifdef PROFILE_ENABLE
+
+/**
+   Marks the beginning of the section (one of the PROFILE_* numbers above) within the current
+   block.
+ */
+#define PROFILE_BEGIN(section) uint32_t profileStart##section = profileCycles()
+
+/**
+   Marks the end of a section begun with PROFILE_BEGIN in the same block, accumulating the
+   cycles spent within it.
+ */
+#define PROFILE_END(section) profileRecord(section, profileStart##section)
+
+/**
+   Starts Timer1 counting CPU cycles and resets the counters.
+ */
+void initProfile(void);
+
+/**
+   Returns the number of CPU cycles since initProfile was called.
+ */
+uint32_t profileCycles(void);
+
+/**
+   Records a pass through the given section that began at the cycle count start.
+ */
+void profileRecord(uint8_t section, uint32_t start);
+
+/**
+   Writes one line per section ("name count total max", cycles in decimal) to the given stream
+   and resets the counters.
+ */
+void dumpProfile(FILE* out);
+
+#else
+
+#define PROFILE_BEGIN(section)
+#define PROFILE_END(section)
+
+#endif
+#endif
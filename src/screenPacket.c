@@ -0,0 +1,237 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File: screenPacket.c
+ */
+
+#include <string.h>
+#include <util/crc16.h>
+
+#include "screenPacket.h"
+
+static uint8_t packet[SCREEN_PACKET_MAX];
+static uint8_t packetLength;
+static uint8_t packetEscaped;  /* the previous byte was SCREEN_PACKET_ESC */
+static uint8_t packetOverflow; /* the frame did not fit in packet */
+
+static void (*replyHandler)(uint8_t);
+
+/*
+  Send the two byte reply for the packet in the buffer.
+ */
+static void reply(uint8_t r) {
+  if (replyHandler) {
+    replyHandler(r);
+    replyHandler(packetLength ? packet[0] : 0);
+  }
+}
+
+/*
+  Apply (or with apply zero, only validate) the delta operations in payload. Returns zero if an
+  operation is truncated, unknown or runs past the end of the screen.
+ */
+static uint8_t applyDelta(const uint8_t* payload, uint8_t length, uint8_t apply) {
+  const uint8_t* end = payload + length;
+  uint8_t cell = 0;
+
+  while (payload < end) {
+    uint8_t op = *payload & SCREEN_DELTA_OP;
+    uint8_t count = (*payload++ & SCREEN_DELTA_COUNT) + 1;
+
+    if (count > LCD_CHARACTERS_PER_SCREEN - cell)
+      return 0;
+
+    switch (op) {
+    case SCREEN_DELTA_SKIP:
+      break;
+    case SCREEN_DELTA_LITERAL:
+      if (end - payload < count)
+        return 0;
+      if (apply)
+        lcdUpdate(cell / LCD_CHARACTERS_PER_LINE + 1, cell % LCD_CHARACTERS_PER_LINE + 1,
+                  (const char*) payload, count);
+      payload += count;
+      break;
+    case SCREEN_DELTA_REPEAT:
+      if (payload == end)
+        return 0;
+      if (apply) {
+        char run[SCREEN_DELTA_MAX];
+        memset(run, *payload, count);
+        lcdUpdate(cell / LCD_CHARACTERS_PER_LINE + 1, cell % LCD_CHARACTERS_PER_LINE + 1, run, count);
+      }
+      payload++;
+      break;
+    default:
+      return 0;
+    }
+
+    cell += count;
+  }
+
+  return 1;
+}
+
+/*
+  Validate and apply the packet of the given length (excluding the CRC) in the buffer. Returns
+  the reply to send.
+ */
+static uint8_t applyPacket(uint8_t length) {
+  const uint8_t* payload = packet + 2;
+  uint8_t payloadLength = length - 2;
+
+  switch (packet[1]) {
+  case SCREEN_PACKET_SCREEN:
+    if (payloadLength != LCD_CHARACTERS_PER_SCREEN)
+      return SCREEN_PACKET_NAK;
+    lcdUpdate(1, 1, (const char*) payload, LCD_CHARACTERS_PER_SCREEN);
+    break;
+  case SCREEN_PACKET_ROW:
+    if (payloadLength != LCD_CHARACTERS_PER_LINE + 1 || payload[0] >= LCD_NUMBER_OF_LINES)
+      return SCREEN_PACKET_NAK;
+    lcdUpdate(payload[0] + 1, 1, (const char*) payload + 1, LCD_CHARACTERS_PER_LINE);
+    break;
+  case SCREEN_PACKET_CELLS:
+    if (payloadLength < 2 || payload[0] + payloadLength - 1 > LCD_CHARACTERS_PER_SCREEN)
+      return SCREEN_PACKET_NAK;
+    lcdUpdate(payload[0] / LCD_CHARACTERS_PER_LINE + 1, payload[0] % LCD_CHARACTERS_PER_LINE + 1,
+              (const char*) payload + 1, payloadLength - 1);
+    break;
+  case SCREEN_PACKET_DELTA:
+    // Validated in full first so that a bad packet leaves the screen untouched
+    if (!applyDelta(payload, payloadLength, 0))
+      return SCREEN_PACKET_NAK;
+    applyDelta(payload, payloadLength, 1);
+    break;
+  case SCREEN_PACKET_EXIT:
+    if (payloadLength != 0)
+      return SCREEN_PACKET_NAK;
+    return SCREEN_PACKET_EXIT;
+  default:
+    return SCREEN_PACKET_NAK;
+  }
+
+  return SCREEN_PACKET_ACK;
+}
+
+/*
+  Check and apply the completed frame, returning the reply to send (or SCREEN_PACKET_EXIT).
+ */
+static uint8_t endPacket(void) {
+  if (packetOverflow || packetLength < 4)
+    return SCREEN_PACKET_NAK;
+
+  // The CRC over the packet including its (little endian) CRC is zero when intact
+  uint16_t crc = 0xffff;
+  for (uint8_t i = 0; i < packetLength; i++)
+    crc = _crc_ccitt_update(crc, packet[i]);
+  if (crc)
+    return SCREEN_PACKET_NAK;
+
+  return applyPacket(packetLength - 2);
+}
+
+/*
+  Send c through the reply handler, escaped as SLIP requires, and return the updated crc.
+ */
+static uint16_t sendEscaped(uint16_t crc, uint8_t c) {
+  if (c == SCREEN_PACKET_END) {
+    replyHandler(SCREEN_PACKET_ESC);
+    replyHandler(SCREEN_PACKET_ESC_END);
+  } else if (c == SCREEN_PACKET_ESC) {
+    replyHandler(SCREEN_PACKET_ESC);
+    replyHandler(SCREEN_PACKET_ESC_ESC);
+  } else {
+    replyHandler(c);
+  }
+  return _crc_ccitt_update(crc, c);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void setScreenPacketReplyHandler(void (*handler)(uint8_t)) {
+  replyHandler = handler;
+}
+
+uint8_t receiveScreenPacketByte(uint8_t c) {
+  if (c == SCREEN_PACKET_END) {
+    uint8_t r = packetLength || packetOverflow ? endPacket() : 0; // Ignore empty frames
+
+    if (r == SCREEN_PACKET_EXIT)
+      return r; // Acknowledged by the caller (packet remains for acknowledgeScreenPacket)
+    if (r)
+      reply(r);
+
+    packetLength = packetEscaped = packetOverflow = 0;
+    return 0;
+  }
+
+  if (c == SCREEN_PACKET_ESC) {
+    packetEscaped = 1;
+    return 0;
+  }
+
+  if (packetEscaped) {
+    packetEscaped = 0;
+    if (c == SCREEN_PACKET_ESC_END)
+      c = SCREEN_PACKET_END;
+    else if (c == SCREEN_PACKET_ESC_ESC)
+      c = SCREEN_PACKET_ESC;
+  }
+
+  if (packetLength < SCREEN_PACKET_MAX)
+    packet[packetLength++] = c;
+  else
+    packetOverflow = 1;
+
+  return 0;
+}
+
+void acknowledgeScreenPacket(void) {
+  reply(SCREEN_PACKET_ACK);
+  packetLength = packetEscaped = packetOverflow = 0;
+}
+
+void sendScreenSnapshot(void) {
+  if (!replyHandler)
+    return;
+
+  uint8_t row, column;
+  getCursorPosition(&row, &column);
+
+  uint8_t header[] = { 0, SCREEN_PACKET_SNAPSHOT, LCD_NUMBER_OF_LINES, LCD_CHARACTERS_PER_LINE,
+                       row - 1, column - 1, getDisplayState() };
+  uint16_t crc = 0xffff;
+
+  replyHandler(SCREEN_PACKET_END);
+  for (uint8_t i = 0; i < sizeof(header); i++)
+    crc = sendEscaped(crc, header[i]);
+
+  // One line at a time keeps the stack use small
+  for (uint8_t i = 1; i <= LCD_NUMBER_OF_LINES; i++) {
+    char line[LCD_CHARACTERS_PER_LINE + 1];
+    readLCDLine(i, line);
+    for (uint8_t j = 0; j < LCD_CHARACTERS_PER_LINE; j++)
+      crc = sendEscaped(crc, line[j]);
+  }
+
+  uint8_t crcLow = crc & 0xff, crcHigh = crc >> 8;
+  sendEscaped(0, crcLow);
+  sendEscaped(0, crcHigh);
+  replyHandler(SCREEN_PACKET_END);
+}
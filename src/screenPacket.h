@@ -0,0 +1,136 @@
+/**
+ * (C) Copyright Collin J. Doering 2015
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file screenPacket.h
+ * @brief Framed binary screen updates, an alternative to ANSI escapes for bulk uploads.
+ *
+ * Binary mode is entered with the private control sequence SCREEN_PACKET_SEQUENCE. Each packet
+ * is then SLIP framed (RFC 1055: terminated by SCREEN_PACKET_END, with END and ESC bytes
+ * within it sent as ESC ESC_END and ESC ESC_ESC) and consists of
+ *
+ *   seq type payload... crc_lo crc_hi
+ *
+ * where seq is chosen by the host and echoed in the reply, and crc is the CRC-CCITT of seq,
+ * type and payload as computed by avr-libc's _crc_ccitt_update starting from 0xffff. Every
+ * packet is answered with the two bytes SCREEN_PACKET_ACK seq once applied, or
+ * SCREEN_PACKET_NAK seq if it was corrupt, truncated or invalid (and so ignored). Cells are
+ * numbered row major from 0 at the top left of the screen; cells that already hold the given
+ * character are not rewritten (see lcdUpdate).
+ *
+ * After the acknowledgement of SCREEN_PACKET_EXIT the device interprets text and ANSI escapes
+ * again; hosts should wait for it before sending text.
+ */
+
+#ifndef SCREEN_PACKET_H
+#define SCREEN_PACKET_H
+
+#include <stdint.h>
+
+#include "lcdLib.h"
+
+/**
+   Private control sequence that enters binary mode.
+ */
+#define SCREEN_PACKET_SEQUENCE "\e[=2p"
+
+/**
+   Private control sequence answered (in text mode) with a SCREEN_PACKET_SNAPSHOT packet.
+ */
+#define SCREEN_SNAPSHOT_SEQUENCE "\e[=3p"
+
+/**
+   SLIP framing bytes.
+ */
+#define SCREEN_PACKET_END     0xc0
+#define SCREEN_PACKET_ESC     0xdb
+#define SCREEN_PACKET_ESC_END 0xdc
+#define SCREEN_PACKET_ESC_ESC 0xdd
+
+/**
+   Packet types.
+ */
+#define SCREEN_PACKET_SCREEN 0x01 ///< LCD_CHARACTERS_PER_SCREEN characters
+#define SCREEN_PACKET_ROW    0x02 ///< Row (0 based) followed by LCD_CHARACTERS_PER_LINE characters
+#define SCREEN_PACKET_CELLS  0x03 ///< Cell offset followed by one or more characters
+#define SCREEN_PACKET_EXIT   0x04 ///< Leave binary mode (no payload)
+#define SCREEN_PACKET_DELTA  0x05 ///< Changes to the current screen (see below)
+
+/**
+   Sent by the device (with seq 0) in answer to SCREEN_SNAPSHOT_SEQUENCE; the payload is
+   LCD_NUMBER_OF_LINES, LCD_CHARACTERS_PER_LINE, the cursor row and column (0 based), the
+   display control state (see getDisplayState) and the LCD_CHARACTERS_PER_SCREEN characters of
+   the screen.
+ */
+#define SCREEN_PACKET_SNAPSHOT 0x81
+
+/**
+   Operations of a SCREEN_PACKET_DELTA payload, applied from cell 0 onwards. Each begins with a
+   byte holding the operation in its top two bits and the count less one (1 to 64) in the rest:
+   skip count cells, write the count characters that follow, or write the following character
+   count times. Cells after the last operation are unchanged. The whole packet is rejected if
+   any operation runs past the end of the screen.
+ */
+#define SCREEN_DELTA_SKIP    0x00
+#define SCREEN_DELTA_LITERAL 0x40
+#define SCREEN_DELTA_REPEAT  0x80
+#define SCREEN_DELTA_OP      0xc0 ///< Mask of the operation
+#define SCREEN_DELTA_COUNT   0x3f ///< Mask of the count less one
+#define SCREEN_DELTA_MAX     64   ///< Largest count of one operation
+
+/**
+   Replies.
+ */
+#define SCREEN_PACKET_ACK 0x06
+#define SCREEN_PACKET_NAK 0x15
+
+/**
+   Largest packet (before framing): a run of cells covering the whole screen.
+ */
+#define SCREEN_PACKET_MAX (LCD_CHARACTERS_PER_SCREEN + 5)
+
+/**
+   Length of a snapshot reply frame (both ENDs included) before escaping; replies are best queued
+   whole, so the transmit buffer should hold one.
+ */
+#define SCREEN_SNAPSHOT_FRAME (LCD_CHARACTERS_PER_SCREEN + 11)
+
+/**
+   Sets the function the two byte replies are sent with (eg. transmitByte).
+ */
+void setScreenPacketReplyHandler(void (*handler)(uint8_t));
+
+/**
+   Feed one received byte to the packet decoder, applying and acknowledging each packet as its
+   frame ends. Returns SCREEN_PACKET_EXIT once an exit packet has been received; it is only
+   acknowledged by a subsequent call to acknowledgeScreenPacket so that the caller can first
+   return to text mode. Otherwise returns 0.
+ */
+uint8_t receiveScreenPacketByte(uint8_t c);
+
+/**
+   Acknowledge the last packet received (used for SCREEN_PACKET_EXIT).
+ */
+void acknowledgeScreenPacket(void);
+
+/**
+   Send a SCREEN_PACKET_SNAPSHOT packet of the current screen through the reply handler. The
+   screen is read from the SRAM shadow when LCD_SHADOW_ENABLE is defined.
+ */
+void sendScreenSnapshot(void);
+
+#endif /* SCREEN_PACKET_H */
@@ -28,19 +28,41 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/power.h>
+#ifdef WATCHDOG_ENABLE
+#include <avr/wdt.h>
+#endif
+#ifdef LCD_CHECKPOINT_ENABLE
+#include <avr/sleep.h>
+#endif
 #include <util/delay.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lcdLib.h"
 #include "ansi_escapes.h"
 #include "USART.h"
+#ifdef SPI_INPUT_ENABLE
+#include "SPI.h"
+#endif
+#ifdef TWI_INPUT_ENABLE
+#include "TWI.h"
+#endif
+#include "profile.h"
+#include "screenPacket.h"
 
+/*
+  Status LED, flashed at startup. PC5 is SCL with TWI_INPUT_ENABLE or PCF8574_MODE, so there is
+  no status LED in those modes.
+ */
+#if !defined (TWI_INPUT_ENABLE) && !defined (PCF8574_MODE)
 #define STATUS_LED_PORT PORTC
 #define STATUS_LED_DDR  DDRC
 #define STATUS_LED      PC5
+#endif
 
 //--------------------------------------------------
 
+#ifdef STATUS_LED
 void flashLED(uint8_t times) {
   while (times > 0) {
     STATUS_LED_PORT |= 1 << STATUS_LED; // turn on status LED
@@ -50,56 +72,456 @@ void flashLED(uint8_t times) {
     times--;
   }
 }
+#endif
+
+//--------------------------------------------------
+
+/*
+  Input is received by the USART, or with SPI_INPUT_ENABLE (eg. -DSPI_INPUT_ENABLE) by the SPI
+  slave (see SPI.h) or with TWI_INPUT_ENABLE by the TWI slave (see TWI.h), in which case the
+  USART only carries replies. INPUT_BYTE_US is the shortest time between input bytes.
+ */
+#if defined (SPI_INPUT_ENABLE) && defined (TWI_INPUT_ENABLE)
+#error "SPI_INPUT_ENABLE and TWI_INPUT_ENABLE are mutually exclusive"
+#endif
+
+#ifdef SPI_INPUT_ENABLE
+#define inputAvailable spiByteAvailable
+#define inputBacklog   spiReceiveBacklog
+#define inputByte      spiReceiveByte
+#define INPUT_BYTE_US  SPI_BYTE_US
+#elif defined (TWI_INPUT_ENABLE)
+#define inputAvailable twiByteAvailable
+#define inputBacklog   twiReceiveBacklog
+#define inputByte      twiReceiveByte
+#define INPUT_BYTE_US  (9 * 1000000UL / TWI_BIT_RATE)
+#else
+#define inputAvailable byteAvailable
+#define inputBacklog   receiveBacklog
+#define inputByte      receiveByte
+#define INPUT_BYTE_US  (10 * 1000000UL / BAUD)
+#endif
+
+/*
+  Input arriving faster than it can be rendered (a receive backlog above BURST_THRESHOLD bytes)
+  is rendered as a burst (see beginLCDBurst): only the SRAM copy of the screen is updated, and
+  the LCD is painted when the input drains (nothing is received for BURST_IDLE_US) or after
+  BURST_REFRESH_BYTES bytes (about BURST_REFRESH_RATE times a second for continuous input).
+ */
+#define BURST_THRESHOLD     16
+#define BURST_REFRESH_RATE  4
+#define BURST_REFRESH_BYTES (1000000UL / INPUT_BYTE_US / BURST_REFRESH_RATE)
+#if defined (SPI_INPUT_ENABLE) || defined (TWI_INPUT_ENABLE)
+#define BURST_IDLE_US       250 // Allows for the master pausing for flow control
+#else
+#define BURST_IDLE_US       (2 * INPUT_BYTE_US) // Two characters
+#endif
+#define BURST_IDLE_POLL_US  50
+
+#if SCREEN_SNAPSHOT_FRAME > USART_TX_BUFFER_SIZE - 1
+#error "USART_TX_BUFFER_SIZE must hold a screen snapshot (see SCREEN_SNAPSHOT_FRAME)"
+#endif
+
+/*
+  Deferred echoes (see echoDeferred) are waited for only while the receive buffer has room left
+  for ECHO_HEADROOM_US of input, the longest the LCD is busy for (a full screen refresh); at baud
+  rates where it has no such room they are dropped straight away.
+ */
+#define ECHO_HEADROOM_US    25000
+#if (USART_RX_BUFFER_SIZE - 1) * INPUT_BYTE_US > ECHO_HEADROOM_US
+#define ECHO_BACKLOG_LIMIT  (USART_RX_BUFFER_SIZE - 1 - ECHO_HEADROOM_US / INPUT_BYTE_US)
+#else
+#define ECHO_BACKLOG_LIMIT  0
+#endif
+
+/*
+  With LCD_CHECKPOINT_ENABLE the screen is checkpointed to EEPROM once input has been idle for
+  CHECKPOINT_SETTLE_MS, at most every CHECKPOINT_INTERVAL_S seconds (bounding EEPROM wear).
+  There is no clock, so time is counted conservatively from the bytes received and, while idle
+  with a checkpoint pending, from Timer0 ticks of CHECKPOINT_TICK_US (sleeping between them);
+  the rest of the time spent asleep is not counted.
+ */
+#ifndef CHECKPOINT_INTERVAL_S
+#define CHECKPOINT_INTERVAL_S 300
+#endif
+#define CHECKPOINT_SETTLE_MS   100
+#define CHECKPOINT_INTERVAL_US (CHECKPOINT_INTERVAL_S * 1000000UL)
+#define CHECKPOINT_BYTE_US     INPUT_BYTE_US
+#define CHECKPOINT_TICK_COUNT  (F_CPU / 1024 / 100) // Timer0 counts (clk/1024) per tick: ~10ms
+#define CHECKPOINT_TICK_US     (CHECKPOINT_TICK_COUNT * 1024 * 1000UL / (F_CPU / 1000))
+
+/*
+  With WATCHDOG_ENABLE (eg. -DWATCHDOG_ENABLE) the device resets if handling input stalls for
+  WATCHDOG_TIMEOUT. The watchdog is disabled while asleep waiting for input.
+ */
+#define WATCHDOG_TIMEOUT WDTO_2S
+
+//--------------------------------------------------
+
+#if !defined (SPI_INPUT_ENABLE) && !defined (TWI_INPUT_ENABLE)
+/*
+  Echo state; mirrors how main consumes escape sequences so that they are not echoed.
+ */
+#define ECHO_TEXT   0
+#define ECHO_ESCAPE 1 // After ESC
+#define ECHO_CSI    2 // Within a control sequence
+#define ECHO_BINARY 3 // In binary mode (see screenPacket.h); nothing is echoed
+
+static volatile uint8_t echoState = ECHO_TEXT;
+
+static volatile uint8_t echoBacklog; // Received bytes whose echo was deferred to main (the newest)
+static uint16_t echoDrops;           // Echoes dropped so as not to lose input
+static volatile uint8_t echoPaused;  // main is queueing a reply; echoes are deferred meanwhile
+
+/*
+  Advances the echo state past c, returning what echoes it (the same translations main did
+  before rendering moved off the echo path), or null if nothing does. The state only advances
+  on bytes that echo nothing, so c can be passed again if its echo had to be deferred.
+ */
+static const char* echoString(uint8_t c) {
+  static char csi[10];
+  static uint8_t csiLength;
+  static char str[2];
+
+  switch (echoState) {
+  case ECHO_ESCAPE: // main discards the byte following ESC unless it begins a CSI
+    echoState = (c == '[') ? ECHO_CSI : ECHO_TEXT;
+    csiLength = 0;
+    return 0;
+  case ECHO_CSI:    // main reads up to 9 bytes, stopping at a final or invalid byte
+    csi[csiLength++] = (c > 0x20 && c < 0x7e) ? c : '\0';
+    if (csiLength == 9 || c <= 0x20 || c >= 0x7e || c >= 0x40) {
+      // Stop echoing as soon as binary mode is requested; main leaves it
+      csi[csiLength] = '\0';
+      echoState = strcmp(csi, SCREEN_PACKET_SEQUENCE + 2) ? ECHO_TEXT : ECHO_BINARY;
+    }
+    return 0;
+  case ECHO_BINARY:
+    return 0;
+  default:
+    break;
+  }
+
+  switch (c) {
+  case '\r':
+    return "\n" CNL(1) "\r";
+  case '\f':
+    return ED(2) CUP(1,1);
+  case 0x7f: // Backspace (sent as delete)
+    return CUB(1) " " CUB(1);
+  case '\e':
+    echoState = ECHO_ESCAPE;
+    return 0;
+  default: // Echo character back to serial console
+    str[0] = c;
+    return str;
+  }
+}
+
+/*
+  Echoes received bytes back to the serial console from the receive interrupt, ahead of (and
+  independent of) rendering them to the LCD. An echo that doesn't fit in the transmit buffer is
+  never waited for here, so that reception is never held up; it and every later echo are
+  deferred to main (see echoDeferred) until main catches up. Echoes are also deferred while
+  main queues a reply, so that none lands in the middle of it (see pauseEcho).
+ */
+static void echoByte(uint8_t c) {
+  if (!echoBacklog && !echoPaused) {
+    const char* s = echoString(c);
+    if (!s || tryTransmitString(s))
+      return;
+  }
+  echoBacklog++;
+}
+
+/*
+  Called by main with each byte it receives: echoes c if its echo was deferred, waiting for room
+  in the transmit buffer while the receive buffer absorbs input. Echo outpacing input (eg. each
+  '\r' is echoed as 6 bytes) would eventually fill the receive buffer, so once it is
+  ECHO_BACKLOG_LIMIT full the echo is dropped instead (and counted) so as not to cost input.
+ */
+static void echoDeferred(uint8_t c) {
+  cli();
+  if (echoBacklog > receiveBacklog()) { // c is one of the newest echoBacklog bytes received
+    sei();
+    const char* s = echoString(c);
+    while (s && !tryTransmitString(s)) {
+      if (receiveBacklog() >= ECHO_BACKLOG_LIMIT) {
+        echoDrops++;
+        break;
+      }
+    }
+    cli();
+    echoBacklog--;
+  }
+  sei();
+}
+
+#define pauseEcho()  (echoPaused = 1)
+#define resumeEcho() (echoPaused = 0)
+#else
+#define pauseEcho()
+#define resumeEcho()
+#endif
+
+/*
+  Answers host queries (eg. DSR) over serial, with echo paused so that it can't split a reply.
+ */
+static void transmitReply(const char* data) {
+  pauseEcho();
+  transmitString(data);
+  resumeEcho();
+}
+
+#ifdef LCD_SHADOW_ENABLE
+/*
+  Waits up to BURST_IDLE_US for a byte to be received, returning non-zero if one was.
+ */
+static uint8_t awaitByte(void) {
+  for (uint16_t t = 0; t < BURST_IDLE_US && !inputAvailable(); t += BURST_IDLE_POLL_US)
+    _delay_us(BURST_IDLE_POLL_US);
+
+  return inputAvailable();
+}
+#endif
+
+/*
+  Receives the next byte, sleeping until one arrives.
+ */
+static uint8_t nextByte(void) {
+  uint8_t c;
+
+#ifdef WATCHDOG_ENABLE
+  if (!inputAvailable()) {
+    wdt_disable();
+    c = inputByte();
+    wdt_enable(WATCHDOG_TIMEOUT);
+  } else {
+    wdt_reset();
+    c = inputByte();
+  }
+#else
+  c = inputByte();
+#endif
+#if !defined (SPI_INPUT_ENABLE) && !defined (TWI_INPUT_ENABLE)
+  echoDeferred(c);
+#endif
+  return c;
+}
+
+#ifdef LCD_CHECKPOINT_ENABLE
+static uint32_t checkpointUs;     // Lower bound of the time since the last checkpoint
+static uint8_t checkpointPending; // Input was rendered since the last checkpoint
+static volatile uint8_t checkpointTicks; // Timer0 ticks not yet counted
+
+ISR(TIMER0_COMPA_vect) {
+  checkpointTicks++;
+}
+
+/*
+  Called when input is idle: sleeps until the checkpoint interval has passed and writes the
+  checkpoint, returning early (to be resumed at the next idle) if input arrives.
+ */
+static void checkpointWhenIdle(void) {
+  uint32_t quietUs = 0;
+
+  if (!checkpointPending)
+    return;
+
+  // Timer0 ticks (in CTC mode) while the CPU sleeps in idle mode
+  checkpointTicks = 0;
+  TCNT0 = 0;
+  OCR0A = CHECKPOINT_TICK_COUNT - 1;
+  TCCR0A = (1 << WGM01);
+  TIMSK0 = (1 << OCIE0A);
+  TCCR0B = (1 << CS02) | (1 << CS00); // clk/1024
+
+  while (checkpointUs < CHECKPOINT_INTERVAL_US || quietUs < CHECKPOINT_SETTLE_MS * 1000UL) {
+    cli();
+    if (inputAvailable()) {
+      sei();
+      break;
+    }
+    if (!checkpointTicks) { // Sleep until the next tick (or input)
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    cli();
+    uint8_t ticks = checkpointTicks;
+    checkpointTicks = 0;
+    sei();
+
+#ifdef WATCHDOG_ENABLE
+    wdt_reset();
+#endif
+    checkpointUs += ticks * CHECKPOINT_TICK_US;
+    quietUs += ticks * CHECKPOINT_TICK_US;
+  }
+
+  TCCR0B = 0;
+  TIMSK0 = 0;
+  if (inputAvailable())
+    return;
+
+  if (beginLCDCheckpoint()) {
+    while (stepLCDCheckpoint()) {
+#ifdef WATCHDOG_ENABLE
+      wdt_reset();
+#endif
+      if (inputAvailable())
+        return; // Abandoned; begun again at the next idle
+    }
+  }
+
+  checkpointPending = 0;
+  checkpointUs = 0;
+}
+#endif
 
 //--------------------------------------------------
 
 int main(void) {
+#ifdef WATCHDOG_ENABLE
+  MCUSR &= ~(1 << WDRF); // The watchdog stays enabled after a watchdog reset until WDRF clears
+  wdt_disable();
+#endif
   clock_prescale_set(clock_div_1);
   
+#ifdef STATUS_LED
   STATUS_LED_DDR |= 1 << STATUS_LED; // DEBUG
+#endif
 
   initUSART();
+#ifdef SPI_INPUT_ENABLE
+  initSPISlave();
+#elif defined (TWI_INPUT_ENABLE)
+  initTWISlave();
+#else
+  setUSARTReceiveHandler(echoByte); // Echo immediately from the receive interrupt
+#endif
   char serialChar;
+#ifdef LCD_SHADOW_ENABLE
+  uint8_t burst = 0;
+  uint16_t burstBytes = 0;
+#endif
+#ifdef LCD_BF_TIMEOUT
+  uint8_t recoverPending = 0; // Input was received since the last recovery attempt
+#endif
 
   initLCD();
+  setLCDResponseHandler(transmitReply);
+  setScreenPacketReplyHandler(transmitByte);
+#ifdef PROFILE_ENABLE
+  initProfile();
+#endif
+  sei();
   //initLCDByInternalReset();
+#ifdef STATUS_LED
   flashLED(5); // DEBUG
+#endif
 
   while (1) {
-    serialChar = receiveByte();
+#ifdef LCD_SHADOW_ENABLE
+    if (burst) {
+      if (++burstBytes == BURST_REFRESH_BYTES || !awaitByte()) {
+        endLCDBurst();
+        burst = 0;
+      }
+    } else if (inputBacklog() > BURST_THRESHOLD) {
+      beginLCDBurst();
+      burst = 1;
+      burstBytes = 0;
+    }
+#endif
+
+    if (!inputAvailable())
+      flushCursorPosition(); // Input is idle; bring the visible cursor up to date
+
+#ifdef LCD_BF_TIMEOUT
+    // A faulted LCD is retried when input goes idle, once per stretch of input
+    if (recoverPending && isLCDFaulted() && !inputAvailable()) {
+      recoverLCD();
+      recoverPending = 0;
+    }
+#endif
+
+#ifdef LCD_CHECKPOINT_ENABLE
+    if (!inputAvailable())
+      checkpointWhenIdle();
+#endif
+
+    serialChar = nextByte();
+#ifdef LCD_BF_TIMEOUT
+    recoverPending = 1;
+#endif
+#ifdef LCD_CHECKPOINT_ENABLE
+    checkpointUs += CHECKPOINT_BYTE_US;
+    checkpointPending = 1;
+#endif
 
     switch (serialChar) {
     case '\r':
       writeStringToLCD("\r\n");
-      transmitString("\n" CNL(1) "\r");
       break;
     case '\f':
       writeCharToLCD(serialChar);
-      transmitString(ED(2) CUP(1,1));
       break;
     case 0x7f: // Backspace (sent as delete)
       writeStringToLCD("\b \b");
-      transmitString(CUB(1) " " CUB(1));
       break;
     case '\e': // Beginning of ANSI escape
       {
-        char j = receiveByte();
+        char j = nextByte();
 
         if (j == '[') {
           char buf[11] = "\e[";
-          for (uint8_t i = 2, j = receiveByte(); i < 10 && j > 0x20 && j < 0x7e; i++, j = receiveByte()) {
+          for (uint8_t i = 2, j = nextByte(); i < 10 && j > 0x20 && j < 0x7e; i++, j = nextByte()) {
             buf[i] = j;
-            if (j > 0x40 && j < 0x7e) {
+            if (j >= 0x40 && j < 0x7e) { // Final byte (including ICH '@')
               break;
             }
           }
+
+          if (strcmp(buf, SCREEN_PACKET_SEQUENCE) == 0) {
+#ifdef LCD_SHADOW_ENABLE
+            endLCDBurst(); // Packets are shown as they arrive
+            burst = 0;
+#endif
+            while (receiveScreenPacketByte(nextByte()) != SCREEN_PACKET_EXIT)
+              ;
+#if !defined (SPI_INPUT_ENABLE) && !defined (TWI_INPUT_ENABLE)
+            echoState = ECHO_TEXT; // Back to text before the host sees the acknowledgement
+#endif
+            pauseEcho(); // Echo mustn't land within the reply frame (breaking its CRC)
+            acknowledgeScreenPacket();
+            resumeEcho();
+            break;
+          }
+
+          if (strcmp(buf, SCREEN_SNAPSHOT_SEQUENCE) == 0) {
+            pauseEcho();
+            sendScreenSnapshot();
+            resumeEcho();
+            break;
+          }
+
+#ifdef PROFILE_ENABLE
+          if (strcmp(buf, PROFILE_DUMP_SEQUENCE) == 0) {
+            dumpProfile(openUSARTStream());
+            break;
+          }
+#endif
+
+          PROFILE_BEGIN(PROFILE_CSI);
           writeStringToLCD(buf);
+          PROFILE_END(PROFILE_CSI);
         }
         break;
       }
     default:
       writeCharToLCD(serialChar);
-      transmitByte(serialChar);   // Echo character back to serial console
     }
   }
 